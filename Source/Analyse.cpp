@@ -0,0 +1,33 @@
+#include <iostream>
+#include <JuceHeader.h>
+#include "SourceAnalysis.h"
+
+// Builds (or validates) the .grainidx analysis sidecar for each source given on the command line.
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cout << "Usage: Analyse <source.wav> [more sources...]" << std::endl;
+        return 1;
+    }
+
+    juce::AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+
+    int failures = 0;
+    for (int i = 1; i < argc; i++) {
+        juce::File source(juce::File::getCurrentWorkingDirectory().getChildFile(argv[i]));
+
+        auto start = juce::Time::getMillisecondCounterHiRes();
+        SourceAnalysisIndex index;
+        if (!index.loadOrBuild(source, formatManager)) {
+            std::cout << "Failed to analyse " << source.getFullPathName() << std::endl;
+            failures++;
+            continue;
+        }
+        auto elapsed = juce::Time::getMillisecondCounterHiRes() - start;
+
+        std::cout << source.getFileName() << ": " << index.getNumFrames() << " frames, "
+                  << index.getNumOnsets() << " onsets (" << elapsed << " ms)" << std::endl;
+    }
+
+    return failures == 0 ? 0 : 1;
+}
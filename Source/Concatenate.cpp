@@ -0,0 +1,125 @@
+#include <iostream>
+#include <map>
+#include <vector>
+#include <JuceHeader.h>
+#include "GrainCorpus.h"
+
+// Concatenative granular playback: rebuilds a target file out of the corpus grains whose
+// descriptors are closest to each of the target's analysis windows.
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cout << "Usage: Concatenate <corpus.grcorpus> <target.wav> <output.wav> [corpus sources...]" << std::endl;
+        std::cout << "The corpus is (re)built from the sources when any are given." << std::endl;
+        return 1;
+    }
+
+    auto cwd = juce::File::getCurrentWorkingDirectory();
+    juce::File corpusFile = cwd.getChildFile(argv[1]);
+    juce::File targetFile = cwd.getChildFile(argv[2]);
+    juce::File outputfile = cwd.getChildFile(argv[3]);
+
+    juce::AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+
+    if (argc > 4) {
+        juce::Array<juce::File> sources;
+        for (int i = 4; i < argc; i++)
+            sources.add(cwd.getChildFile(argv[i]));
+
+        if (!GrainCorpus::build(sources, formatManager, corpusFile)) {
+            std::cout << "Failed to build corpus." << std::endl;
+            return 1;
+        }
+    }
+
+    GrainCorpus corpus;
+    if (!corpus.load(corpusFile) || corpus.getNumGrains() == 0) {
+        std::cout << "Failed to load corpus." << std::endl;
+        return 1;
+    }
+
+    SourceAnalysisIndex target;
+    if (!target.loadOrBuild(targetFile, formatManager)) {
+        std::cout << "Failed to analyse target." << std::endl;
+        return 1;
+    }
+
+    // Query every target window in one batch, keeping a few candidates per window
+    // so that steady passages don't repeat the same grain.
+    const int numFrames = target.getNumFrames();
+    const int candidates = 4;
+    std::vector<float> queries(static_cast<size_t>(numFrames) * CorpusGrain::numFeatures);
+    for (int f = 0; f < numFrames; f++)
+        corpus.normalise(target.getFrame(f), queries.data() + static_cast<size_t>(f) * CorpusGrain::numFeatures);
+
+    std::vector<CorpusNeighbour> matches(static_cast<size_t>(numFrames) * candidates);
+    auto start = juce::Time::getMillisecondCounterHiRes();
+    corpus.searchBatch(queries.data(), numFrames, candidates, matches.data());
+    auto elapsed = juce::Time::getMillisecondCounterHiRes() - start;
+    std::cout << numFrames << " queries against " << corpus.getNumGrains() << " grains in " << elapsed << " ms" << std::endl;
+
+    // Grains are Hann-windowed and overlap-added at half the window length, which sums to unity.
+    const int grainSamples = target.getWindowSize();
+    const int hop = grainSamples / 2;
+    const int numchannels = 2;
+    juce::AudioBuffer<float> outputBuffer(numchannels, (numFrames - 1) * hop + grainSamples);
+    outputBuffer.clear();
+
+    std::vector<float> window(static_cast<size_t>(grainSamples));
+    juce::dsp::WindowingFunction<float>::fillWindowingTables(window.data(), static_cast<size_t>(grainSamples),
+                                                             juce::dsp::WindowingFunction<float>::hann, false);
+
+    std::map<int, std::unique_ptr<juce::AudioFormatReader>> readers;
+    juce::AudioBuffer<float> grainBuffer(numchannels, grainSamples);
+    juce::Random random(1);
+
+    for (int f = 0; f < numFrames; f++) {
+        auto& match = matches[static_cast<size_t>(f) * candidates + static_cast<size_t>(random.nextInt(candidates))];
+        if (match.grain >= static_cast<juce::uint32>(corpus.getNumGrains()))
+            continue;
+
+        auto& grain = corpus.getGrain(static_cast<int>(match.grain));
+        auto& reader = readers[static_cast<int>(grain.sourceIndex)];
+        if (!reader)
+            reader.reset(formatManager.createReaderFor(corpus.getSource(static_cast<int>(grain.sourceIndex))));
+        if (!reader)
+            continue;
+
+        // Mono sources are copied to both output channels.
+        reader->read(&grainBuffer, 0, grainSamples, grain.position, true, true);
+        for (int chan = 0; chan < numchannels; chan++) {
+            const float* src = grainBuffer.getReadPointer(juce::jmin(chan, static_cast<int>(reader->numChannels) - 1));
+            float* outData = outputBuffer.getWritePointer(chan, f * hop);
+            for (int j = 0; j < grainSamples; j++)
+                outData[j] += src[j] * window[static_cast<size_t>(j)];
+        }
+    }
+
+    std::unique_ptr<juce::FileOutputStream> fileStream(outputfile.createOutputStream());
+    if (!fileStream) {
+        std::cout << "Failed to create output stream." << std::endl;
+        return 1;
+    }
+    fileStream->setPosition(0);
+    fileStream->truncate();
+
+    std::unique_ptr<juce::AudioFormatWriter> writer(
+        formatManager.findFormatForFileExtension("wav")->createWriterFor(
+            fileStream.get(),
+            target.getSampleRate(),
+            static_cast<unsigned int>(numchannels),
+            16,
+            {},
+            0));
+
+    if (!writer) {
+        std::cout << "Failed to create writer." << std::endl;
+        return 1;
+    }
+    fileStream.release();
+
+    writer->writeFromAudioSampleBuffer(outputBuffer, 0, outputBuffer.getNumSamples());
+
+    std::cout << "Concatenative synthesis complete." << std::endl;
+    return 0;
+}
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+#include "ParallelRender.h"
+#include "Resampler.h"
+#include "Trace.h"
+
+// Convolves a whole render with an impulse response (a room, a plate, a speaker), in one of two ways.
+//
+// realtime streams the render through juce::dsp::Convolution in small blocks, with a short head
+// partition and longer tail partitions (non-uniform partitioning), exactly as a live chain would.
+//
+// offline has the whole render up front and no latency to keep down, so it cuts the IR into a few
+// large partitions instead, sized to need the least work per output sample, and shares their FFTs
+// and spectral multiply-adds out across threads. Long IRs render many times faster this way, and
+// the two modes agree to float rounding.
+//
+// Output channel c uses IR channel c, or the IR's last channel if it has fewer.
+class ConvolutionStage {
+public:
+    enum class Mode { realtime, offline };
+
+    // Takes an IR already at the engine rate. normalise scales it as juce::dsp::Convolution's
+    // Normalise::yes does, so a wet signal sits at a similar level whatever the IR.
+    void setImpulseResponse(juce::AudioBuffer<float> newImpulse, double newSampleRate, bool normalise = true) {
+        impulse = std::move(newImpulse);
+        sampleRate = newSampleRate;
+        if (normalise)
+            impulse.applyGain(getNormalisationGain(impulse));
+    }
+
+    // Loads an IR file converted to engineRate (through the resample cache, as sources are).
+    bool loadImpulseResponse(const juce::File& file, double engineRate, juce::AudioFormatManager& formatManager,
+                             bool normalise = true, DecodedSourceCache* decodeCache = nullptr) {
+        juce::AudioBuffer<float> loaded;
+        if (!loadSourceAtRate(file, engineRate, formatManager, loaded, decodeCache) || loaded.getNumSamples() == 0)
+            return false;
+        setImpulseResponse(std::move(loaded), engineRate, normalise);
+        return true;
+    }
+
+    bool hasImpulseResponse() const { return impulse.getNumSamples() > 0; }
+    int getImpulseLength() const { return impulse.getNumSamples(); }
+
+    // How much longer than its input the result is: the IR's tail.
+    int getTailLength() const { return juce::jmax(0, impulse.getNumSamples() - 1); }
+
+    // Returns input convolved with the IR, getTailLength() samples longer than input.
+    // numThreads applies to offline mode (0 = one per CPU).
+    juce::AudioBuffer<float> process(const juce::AudioBuffer<float>& input, Mode mode = Mode::offline, int numThreads = 0) const {
+        juce::AudioBuffer<float> output(input.getNumChannels(), input.getNumSamples() + getTailLength());
+        output.clear();
+        if (!hasImpulseResponse() || input.getNumSamples() == 0)
+            return output;
+
+        if (mode == Mode::realtime)
+            processRealtime(input, output);
+        else
+            processOffline(input, output, numThreads);
+        return output;
+    }
+
+    // The offline partition size for an IR of impulseLength samples: the power of two that costs
+    // least per output sample, counting two FFTs of twice its size per block (one forward, one
+    // inverse) and one spectral multiply-add per partition per block. Bigger partitions mean
+    // fewer of them but dearer FFTs, and past 32k samples the FFTs no longer fit in cache.
+    static int choosePartitionSize(int impulseLength) {
+        int best = minPartitionSize;
+        double bestCost = 0.0;
+        for (int size = minPartitionSize; size <= maxPartitionSize; size *= 2) {
+            const double numPartitions = (impulseLength + size - 1) / size;
+            const double fftCost = 2.0 * fftWeight * (2.0 * size) * std::log2(2.0 * size);
+            const double cost = (fftCost + numPartitions * 4.0 * (size + 1)) / size;
+            if (size == minPartitionSize || cost < bestCost) {
+                best = size;
+                bestCost = cost;
+            }
+            if (size >= impulseLength)
+                break;
+        }
+        return best;
+    }
+
+private:
+    static constexpr int minPartitionSize = 1 << 10;
+    static constexpr int maxPartitionSize = 1 << 15;
+    static constexpr double fftWeight = 2.5;  // cost of a size-n real FFT, in units of n log2 n
+    static constexpr int realtimeBlockSize = 512;
+    static constexpr int realtimeHeadSize = 4096;
+
+    // juce::dsp::Convolution's normalisation: 0.125 over the root of the loudest channel's energy.
+    static float getNormalisationGain(const juce::AudioBuffer<float>& buffer) {
+        double maxEnergy = 0.0;
+        for (int chan = 0; chan < buffer.getNumChannels(); chan++) {
+            double energy = 0.0;
+            const float* data = buffer.getReadPointer(chan);
+            for (int i = 0; i < buffer.getNumSamples(); i++)
+                energy += static_cast<double>(data[i]) * data[i];
+            maxEnergy = juce::jmax(maxEnergy, energy);
+        }
+        return maxEnergy < 1.0e-8 ? 1.0f : static_cast<float>(0.125 / std::sqrt(maxEnergy));
+    }
+
+    int getImpulseChannel(int chan) const { return juce::jmin(chan, impulse.getNumChannels() - 1); }
+
+    // juce::dsp::Convolution handles at most two channels, so channels go through it in pairs.
+    void processRealtime(const juce::AudioBuffer<float>& input, juce::AudioBuffer<float>& output) const {
+        TRACE_SCOPE("convolve (realtime)");
+        const int outputLength = output.getNumSamples();
+
+        for (int first = 0; first < input.getNumChannels(); first += 2) {
+            const int numChannels = juce::jmin(2, input.getNumChannels() - first);
+
+            juce::AudioBuffer<float> pairImpulse(numChannels, impulse.getNumSamples());
+            for (int chan = 0; chan < numChannels; chan++)
+                pairImpulse.copyFrom(chan, 0, impulse, getImpulseChannel(first + chan), 0, impulse.getNumSamples());
+
+            // An IR loaded before prepare() is installed there and then, rather than on the loader thread
+            juce::dsp::Convolution convolution { juce::dsp::Convolution::NonUniform { realtimeHeadSize } };
+            convolution.loadImpulseResponse(std::move(pairImpulse), sampleRate,
+                                            numChannels == 2 ? juce::dsp::Convolution::Stereo::yes : juce::dsp::Convolution::Stereo::no,
+                                            juce::dsp::Convolution::Trim::no, juce::dsp::Convolution::Normalise::no);
+            convolution.prepare({ sampleRate, static_cast<juce::uint32>(realtimeBlockSize), static_cast<juce::uint32>(numChannels) });
+            const int latency = convolution.getLatency();
+
+            // Run past the end of the input, long enough for the tail and the latency to come out
+            juce::AudioBuffer<float> block(numChannels, realtimeBlockSize);
+            for (int pos = 0; pos < outputLength + latency; pos += realtimeBlockSize) {
+                const int n = juce::jmin(realtimeBlockSize, outputLength + latency - pos);
+                block.clear();
+                for (int chan = 0; chan < numChannels; chan++)
+                    if (pos < input.getNumSamples())
+                        block.copyFrom(chan, 0, input, first + chan, pos, juce::jmin(n, input.getNumSamples() - pos));
+
+                juce::dsp::AudioBlock<float> audioBlock(block.getArrayOfWritePointers(), static_cast<size_t>(numChannels),
+                                                        static_cast<size_t>(n));
+                convolution.process(juce::dsp::ProcessContextReplacing<float>(audioBlock));
+
+                // Output sample pos + i is really sample pos + i - latency
+                const int skip = juce::jmax(0, latency - pos);
+                if (skip < n)
+                    for (int chan = 0; chan < numChannels; chan++)
+                        output.copyFrom(first + chan, pos + skip - latency, block, chan, skip, n - skip);
+            }
+        }
+    }
+
+    // Uniformly partitioned overlap-add with big partitions of `size` samples. The IR's partition
+    // spectra are taken once; then, a run of blocks at a time, every input block's spectrum is
+    // taken and every output block summed from the input spectra and partition spectra that meet
+    // at it, each block (and channel) a separate job. Only the input spectra the current run can
+    // reach are kept, in a ring, so memory is bounded by the IR, not by the render's length.
+    void processOffline(const juce::AudioBuffer<float>& input, juce::AudioBuffer<float>& output, int numThreads) const {
+        TRACE_SCOPE("convolve (offline)");
+        if (numThreads <= 0)
+            numThreads = juce::SystemStats::getNumCpus();
+
+        const int size = choosePartitionSize(impulse.getNumSamples());
+        const int fftSize = size * 2;
+        const int numBins = size + 1;
+        const int spectrumSize = numBins * 2;  // split real and imaginary parts
+        const int numChannels = input.getNumChannels();
+        const int numImpulseChannels = impulse.getNumChannels();
+        const int numPartitions = (impulse.getNumSamples() + size - 1) / size;
+        const int numInputBlocks = (input.getNumSamples() + size - 1) / size;
+        const int numOutputBlocks = (output.getNumSamples() + size - 1) / size;
+
+        // An FFT (and its scratch) per thread: juce's fallback engine locks around each transform
+        const int order = juce::roundToInt(std::log2(fftSize));
+        std::vector<std::unique_ptr<juce::dsp::FFT>> ffts;
+        std::vector<std::vector<float>> scratch;
+        for (int t = 0; t < numThreads; t++) {
+            ffts.push_back(std::make_unique<juce::dsp::FFT>(order));
+            scratch.emplace_back(static_cast<size_t>(fftSize) * 2);
+        }
+
+        // Zero-pads and transforms samples, leaving the spectrum split into re[numBins], im[numBins].
+        auto transform = [&](const float* samples, int numSamples, float* spectrum, int thread) {
+            float* data = scratch[static_cast<size_t>(thread)].data();
+            std::fill(data, data + fftSize * 2, 0.0f);
+            std::copy(samples, samples + numSamples, data);
+            ffts[static_cast<size_t>(thread)]->performRealOnlyForwardTransform(data, true);
+            for (int bin = 0; bin < numBins; bin++) {
+                spectrum[bin] = data[bin * 2];
+                spectrum[numBins + bin] = data[bin * 2 + 1];
+            }
+        };
+
+        std::vector<float> partitions(static_cast<size_t>(numImpulseChannels) * static_cast<size_t>(numPartitions) * static_cast<size_t>(spectrumSize));
+        auto getPartition = [&](int chan, int k) {
+            return partitions.data() + (static_cast<size_t>(chan) * static_cast<size_t>(numPartitions) + static_cast<size_t>(k)) * static_cast<size_t>(spectrumSize);
+        };
+        parallelFor(numImpulseChannels * numPartitions, numThreads, [&](int job, int thread) {
+            const int chan = job / numPartitions, k = job % numPartitions;
+            transform(impulse.getReadPointer(chan, k * size), juce::jmin(size, impulse.getNumSamples() - k * size),
+                      getPartition(chan, k), thread);
+        });
+
+        // Blocks per run; the ring holds every input spectrum a run's output blocks can reach
+        const int runLength = juce::jmax(8, numThreads * 4);
+        const int ringSize = numPartitions + runLength;
+        std::vector<float> inputSpectra(static_cast<size_t>(numChannels) * static_cast<size_t>(ringSize) * static_cast<size_t>(spectrumSize));
+        auto getInputSpectrum = [&](int chan, int block) {
+            return inputSpectra.data() + (static_cast<size_t>(chan) * static_cast<size_t>(ringSize) + static_cast<size_t>(block % ringSize)) * static_cast<size_t>(spectrumSize);
+        };
+
+        // Each output block's inverse transform, 2 * size samples, overlap-added once the run is done
+        std::vector<float> results(static_cast<size_t>(runLength) * static_cast<size_t>(numChannels) * static_cast<size_t>(fftSize));
+        std::vector<std::vector<float>> accumulators(static_cast<size_t>(numThreads), std::vector<float>(static_cast<size_t>(spectrumSize)));
+
+        for (int runStart = 0; runStart < numOutputBlocks; runStart += runLength) {
+            const int runEnd = juce::jmin(numOutputBlocks, runStart + runLength);
+
+            const int newInputs = juce::jmax(0, juce::jmin(runEnd, numInputBlocks) - runStart);
+            parallelFor(newInputs * numChannels, numThreads, [&](int job, int thread) {
+                const int block = runStart + job / numChannels, chan = job % numChannels;
+                transform(input.getReadPointer(chan, block * size), juce::jmin(size, input.getNumSamples() - block * size),
+                          getInputSpectrum(chan, block), thread);
+            });
+
+            parallelFor((runEnd - runStart) * numChannels, numThreads, [&](int job, int thread) {
+                const int block = runStart + job / numChannels, chan = job % numChannels;
+                float* acc = accumulators[static_cast<size_t>(thread)].data();
+                std::fill(acc, acc + spectrumSize, 0.0f);
+
+                // Y = sum over k of X[block - k] H[k], as split complex multiply-adds
+                for (int k = juce::jmax(0, block - numInputBlocks + 1); k <= juce::jmin(numPartitions - 1, block); k++) {
+                    const float* x = getInputSpectrum(chan, block - k);
+                    const float* h = getPartition(getImpulseChannel(chan), k);
+                    juce::FloatVectorOperations::addWithMultiply(acc, x, h, numBins);
+                    juce::FloatVectorOperations::subtractWithMultiply(acc, x + numBins, h + numBins, numBins);
+                    juce::FloatVectorOperations::addWithMultiply(acc + numBins, x, h + numBins, numBins);
+                    juce::FloatVectorOperations::addWithMultiply(acc + numBins, x + numBins, h, numBins);
+                }
+
+                float* data = scratch[static_cast<size_t>(thread)].data();
+                for (int bin = 0; bin < numBins; bin++) {
+                    data[bin * 2] = acc[bin];
+                    data[bin * 2 + 1] = acc[numBins + bin];
+                }
+                ffts[static_cast<size_t>(thread)]->performRealOnlyInverseTransform(data);
+
+                float* result = results.data() + static_cast<size_t>(job) * static_cast<size_t>(fftSize);
+                std::copy(data, data + fftSize, result);
+            });
+
+            for (int block = runStart; block < runEnd; block++) {
+                for (int chan = 0; chan < numChannels; chan++) {
+                    const float* result = results.data() + static_cast<size_t>((block - runStart) * numChannels + chan) * static_cast<size_t>(fftSize);
+                    const int start = block * size;
+                    const int n = juce::jmin(fftSize, output.getNumSamples() - start);
+                    juce::FloatVectorOperations::add(output.getWritePointer(chan, start), result, n);
+                }
+            }
+        }
+    }
+
+    juce::AudioBuffer<float> impulse;
+    double sampleRate = 48000.0;
+};
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "ParallelDecoder.h"
+
+// How decoded samples are stored in the cache. int16 halves the disk and page cache footprint,
+// which is plenty for sources that were lossy to begin with.
+enum class DecodedSampleFormat : juce::uint32 { float32 = 0, int16 = 1 };
+
+// Header of a "<content hash>.decoded" cache file, followed by planar channel data in the
+// stored format.
+struct DecodedCacheHeader {
+    char magic[8];
+    juce::uint32 version;
+    DecodedSampleFormat format;
+    juce::uint32 numChannels;
+    juce::uint32 reserved;
+    double sampleRate;
+    juce::int64 numSamples;
+    juce::uint64 contentHash;
+    juce::int64 contentSize;
+};
+
+static_assert(sizeof(DecodedCacheHeader) == 56, "cache header layout must stay fixed");
+
+// A memory-mapped cache entry. float32 entries can be read in place through getChannel().
+class DecodedSource {
+public:
+    explicit DecodedSource(const juce::File& file) : mapped(file, juce::MemoryMappedFile::readOnly) {}
+
+    bool isValid(juce::uint64 hash, juce::int64 size) const {
+        if (mapped.getData() == nullptr || mapped.getSize() < sizeof(DecodedCacheHeader))
+            return false;
+        auto& h = getHeader();
+        return std::memcmp(h.magic, "GRNDEC\0\0", 8) == 0
+            && h.version == 1
+            && h.contentHash == hash
+            && h.contentSize == size
+            && mapped.getSize() >= sizeof(DecodedCacheHeader) + getDataSize();
+    }
+
+    int getNumChannels() const { return static_cast<int>(getHeader().numChannels); }
+    juce::int64 getNumSamples() const { return getHeader().numSamples; }
+    double getSampleRate() const { return getHeader().sampleRate; }
+    DecodedSampleFormat getFormat() const { return getHeader().format; }
+
+    // Channel data in place; only for float32 entries.
+    const float* getChannel(int chan) const {
+        jassert(getFormat() == DecodedSampleFormat::float32);
+        return reinterpret_cast<const float*>(channelData(chan));
+    }
+
+    // Copies (converting if needed) the whole source into dest.
+    void read(juce::AudioBuffer<float>& dest) const {
+        const int n = static_cast<int>(getNumSamples());
+        dest.setSize(getNumChannels(), n);
+        for (int chan = 0; chan < getNumChannels(); chan++) {
+            if (getFormat() == DecodedSampleFormat::float32) {
+                dest.copyFrom(chan, 0, getChannel(chan), n);
+            }
+            else {
+                auto* src = reinterpret_cast<const juce::int16*>(channelData(chan));
+                float* d = dest.getWritePointer(chan);
+                for (int i = 0; i < n; i++)
+                    d[i] = src[i] * (1.0f / 32768.0f);
+            }
+        }
+    }
+
+private:
+    const DecodedCacheHeader& getHeader() const { return *static_cast<const DecodedCacheHeader*>(mapped.getData()); }
+
+    size_t getBytesPerSample() const { return getFormat() == DecodedSampleFormat::int16 ? 2 : 4; }
+
+    size_t getDataSize() const {
+        return static_cast<size_t>(getHeader().numChannels) * static_cast<size_t>(getHeader().numSamples) * getBytesPerSample();
+    }
+
+    const char* channelData(int chan) const {
+        return static_cast<const char*>(mapped.getData()) + sizeof(DecodedCacheHeader)
+             + static_cast<size_t>(chan) * static_cast<size_t>(getNumSamples()) * getBytesPerSample();
+    }
+
+    juce::MemoryMappedFile mapped;
+};
+
+// Persistent cache of decoded compressed sources (FLAC, Ogg, MP3), so repeat runs map the
+// decoded samples instead of decoding again.
+//
+// Entries are keyed by a hash of the source's bytes rather than its path or date, so a changed
+// source simply misses and an identical copy anywhere hits. Hashing runs at memory speed, far
+// faster than decoding. Whenever an entry is written, the least recently used entries are
+// deleted until the cache fits its size limit.
+class DecodedSourceCache {
+public:
+    static juce::File getDefaultDirectory() {
+        return juce::File::getSpecialLocation(juce::File::tempDirectory).getChildFile("GranularDecodeCache");
+    }
+
+    DecodedSourceCache(const juce::File& cacheDirectory = getDefaultDirectory(),
+                       juce::int64 maxCacheBytes = juce::int64(2) << 30,
+                       DecodedSampleFormat storedFormat = DecodedSampleFormat::float32)
+        : directory(cacheDirectory), maxBytes(maxCacheBytes), format(storedFormat) {
+        directory.createDirectory();
+    }
+
+    // Uncompressed formats read as fast as the cache would, so they aren't worth an entry.
+    static bool isWorthCaching(const juce::File& source) {
+        return !source.hasFileExtension("wav;wave;aif;aiff;bwf");
+    }
+
+    // Maps the cached decode of source, decoding and storing it first on a miss.
+    // Returns nullptr if the source can't be read.
+    std::unique_ptr<DecodedSource> open(const juce::File& source, juce::AudioFormatManager& formatManager) {
+        juce::uint64 hash = 0;
+        juce::int64 size = 0;
+        if (!hashContents(source, hash, size))
+            return nullptr;
+
+        auto entry = getEntryFile(hash);
+        if (auto cached = openEntry(entry, hash, size))
+            return cached;
+
+        juce::AudioBuffer<float> decoded;
+        double sampleRate = 0.0;
+        if (!readWholeSource(source, formatManager, decoded, sampleRate))
+            return nullptr;
+
+        if (!writeEntry(entry, decoded, sampleRate, hash, size))
+            return nullptr;
+
+        trim(entry);
+        return openEntry(entry, hash, size);
+    }
+
+    // Total bytes of all entries in the cache directory.
+    juce::int64 getCacheSize() const {
+        juce::int64 total = 0;
+        for (auto& f : directory.findChildFiles(juce::File::findFiles, false, "*.decoded"))
+            total += f.getSize();
+        return total;
+    }
+
+    // 64-bit hash of a file's bytes, consumed eight at a time in four independent lanes.
+    static bool hashContents(const juce::File& file, juce::uint64& hash, juce::int64& size) {
+        juce::MemoryMappedFile mapped(file, juce::MemoryMappedFile::readOnly);
+        if (mapped.getData() == nullptr && file.getSize() != 0)
+            return false;
+
+        const auto* bytes = static_cast<const unsigned char*>(mapped.getData());
+        const size_t length = mapped.getSize();
+        constexpr juce::uint64 prime1 = 0x9E3779B185EBCA87ull, prime2 = 0xC2B2AE3D27D4EB4Full;
+        juce::uint64 lanes[4] = { prime1, prime2, ~prime1, ~prime2 };
+
+        auto mix = [](juce::uint64 lane, juce::uint64 word) {
+            lane += word * prime2;
+            lane = (lane << 31) | (lane >> 33);
+            return lane * prime1;
+        };
+
+        size_t i = 0;
+        for (; i + 32 <= length; i += 32) {
+            for (int l = 0; l < 4; l++) {
+                juce::uint64 word;
+                std::memcpy(&word, bytes + i + static_cast<size_t>(l) * 8, 8);
+                lanes[l] = mix(lanes[l], word);
+            }
+        }
+
+        juce::uint64 h = static_cast<juce::uint64>(length) * prime1;
+        for (auto lane : lanes)
+            h = mix(h ^ lane, lane);
+        for (; i < length; i++)
+            h = mix(h, bytes[i]);
+
+        h ^= h >> 33;
+        h *= prime2;
+        h ^= h >> 29;
+
+        hash = h;
+        size = static_cast<juce::int64>(length);
+        return true;
+    }
+
+private:
+    juce::File getEntryFile(juce::uint64 hash) const {
+        return directory.getChildFile(juce::String::toHexString(static_cast<juce::int64>(hash)).paddedLeft('0', 16) + ".decoded");
+    }
+
+    static std::unique_ptr<DecodedSource> openEntry(const juce::File& entry, juce::uint64 hash, juce::int64 size) {
+        if (!entry.existsAsFile())
+            return nullptr;
+
+        auto source = std::make_unique<DecodedSource>(entry);
+        if (!source->isValid(hash, size))
+            return nullptr;
+
+        entry.setLastAccessTime(juce::Time::getCurrentTime());
+        return source;
+    }
+
+    bool writeEntry(const juce::File& entry, const juce::AudioBuffer<float>& decoded, double sampleRate,
+                    juce::uint64 hash, juce::int64 size) const {
+        DecodedCacheHeader h {};
+        std::memcpy(h.magic, "GRNDEC\0\0", 8);
+        h.version = 1;
+        h.format = format;
+        h.numChannels = static_cast<juce::uint32>(decoded.getNumChannels());
+        h.sampleRate = sampleRate;
+        h.numSamples = decoded.getNumSamples();
+        h.contentHash = hash;
+        h.contentSize = size;
+
+        juce::TemporaryFile temp(entry);
+        {
+            juce::FileOutputStream out(temp.getFile());
+            if (!out.openedOk())
+                return false;
+
+            out.write(&h, sizeof(h));
+            std::vector<juce::int16> converted;
+            for (int chan = 0; chan < decoded.getNumChannels(); chan++) {
+                const float* data = decoded.getReadPointer(chan);
+                const auto n = static_cast<size_t>(decoded.getNumSamples());
+                if (format == DecodedSampleFormat::float32) {
+                    out.write(data, n * sizeof(float));
+                }
+                else {
+                    converted.resize(n);
+                    for (size_t i = 0; i < n; i++)
+                        converted[i] = static_cast<juce::int16>(juce::jlimit(-32768, 32767, juce::roundToInt(data[i] * 32768.0f)));
+                    out.write(converted.data(), n * sizeof(juce::int16));
+                }
+            }
+            out.flush();
+            if (out.getStatus().failed())
+                return false;
+        }
+        return temp.overwriteTargetFileWithTemporary();
+    }
+
+    // Deletes least recently used entries other than keep until the cache fits maxBytes.
+    void trim(const juce::File& keep) const {
+        auto files = directory.findChildFiles(juce::File::findFiles, false, "*.decoded");
+        std::sort(files.begin(), files.end(), [](const juce::File& a, const juce::File& b) {
+            return a.getLastAccessTime() < b.getLastAccessTime();
+        });
+
+        juce::int64 total = 0;
+        for (auto& f : files)
+            total += f.getSize();
+
+        for (auto& f : files) {
+            if (total <= maxBytes)
+                break;
+            if (f == keep)
+                continue;
+            total -= f.getSize();
+            f.deleteFile();
+        }
+    }
+
+    juce::File directory;
+    juce::int64 maxBytes;
+    DecodedSampleFormat format;
+};
@@ -1,6 +1,7 @@
 #include <JuceHeader.h>
 #include <iostream>
 #include <vector>
+#include "GrainRenderer.h"
 
 
 float timetosamples(float time, int samplerate) {
@@ -8,7 +9,10 @@ float timetosamples(float time, int samplerate) {
 }
 
 
-void env(juce::AudioBuffer<float>& buffer, float attacktime, float decaytime, float sustainlevel, float releasetime, float samplerate) {
+// Applies an ADSR envelope to every channel. curve bends the attack, decay and release into
+// exponential segments (0 is linear, positive is analog-style); see GrainEnvelopeShapes::CurvedADSR.
+// Each segment is generated recursively, one multiply-add per sample.
+void env(juce::AudioBuffer<float>& buffer, float attacktime, float decaytime, float sustainlevel, float releasetime, float samplerate, float curve = 0.0f) {
 
 
 if (attacktime <= 0.0f)
@@ -23,51 +27,17 @@ if (releasetime <= 0.0f)
    releasetime = 0.1f;
 
 
-float totalattacksamples = timetosamples(attacktime, samplerate);
-float totaldecaysamples = timetosamples(decaytime, samplerate);
-float totalreleasesamples = timetosamples(releasetime, samplerate);
+GrainShape shape;
+shape.attack  = (int) timetosamples(attacktime, samplerate);
+shape.decay   = (int) timetosamples(decaytime, samplerate);
+shape.release = (int) timetosamples(releasetime, samplerate);
+shape.sustain = sustainlevel;
+shape.curve   = curve;
 
 
-int totalsamples = buffer.getNumSamples();
-
-
-for (int chan = 0; chan < buffer.getNumChannels(); chan++)
-{
-float* channelData = buffer.getWritePointer(chan);
-
-
-float attackEnd = totalattacksamples;
-float decayEnd  = totalattacksamples + totaldecaysamples;
-float sustainEnd = totalsamples - totalreleasesamples;
-
-
-if (sustainEnd < decayEnd)
-       sustainEnd = decayEnd;
-
-
-for (int i = 0; i < totalsamples; i++) {
-   float amplitude = 0.0f;
-
-
-   if (i < attackEnd) {
-       amplitude = (float)i / attackEnd;
-   }
-   else if (i < decayEnd) {
-       amplitude = 1.0f + ((float)i - attackEnd) * ((sustainlevel - 1.0f) / (decayEnd - attackEnd));
-   }
-   else if (i < sustainEnd) {
-       amplitude = sustainlevel;
-   }
-   else {
-       if (totalsamples - 1 > sustainEnd)
-           amplitude = sustainlevel + ((float)i - sustainEnd) * (- sustainlevel) /(totalsamples - 1 - sustainEnd);
-       else
-           amplitude = 0.0f;
-   }
-  
-   channelData[i] *= amplitude;
-}
-}
+auto render = getGrainRenderer<float>(EnvelopeShape::curvedADSR);
+render(buffer.getArrayOfReadPointers(), buffer.getArrayOfWritePointers(), buffer.getNumChannels(),
+       buffer.getNumSamples(), shape, 1.0f);
 }
 
 
@@ -120,10 +90,11 @@ float attackTime  = fileduration * attackFrac;
 float decayTime   = fileduration * decayFrac;
 float releaseTime = fileduration * releaseFrac;
 float sustainLevel = 0.5f;
+float curve = 4.0f;
 
 
 //APPLY ENVELOPE FUNCTION
-env(buffer, attackTime, decayTime, sustainLevel, releaseTime, (float)samplerate);
+env(buffer, attackTime, decayTime, sustainLevel, releaseTime, (float)samplerate, curve);
 
 
 // Creating a unique pointer for the writer
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include "SourceAnalysis.h"
+
+// One candidate grain in a corpus: its normalised descriptor vector and where to find its audio.
+struct CorpusGrain {
+    static constexpr int numFeatures = static_cast<int>(Descriptor::numDescriptors);
+
+    float features[numFeatures];
+    juce::uint32 sourceIndex;
+    juce::uint32 length;
+    juce::int64 position;
+};
+
+struct CorpusHeader {
+    char magic[8];
+    juce::uint32 version;
+    juce::uint32 numFeatures;
+    juce::uint64 numGrains;
+    juce::uint32 numSources;
+    juce::uint32 leafSize;
+    juce::uint64 namesOffset;
+    float mean[CorpusGrain::numFeatures];
+    float scale[CorpusGrain::numFeatures];
+};
+
+static_assert(sizeof(CorpusGrain) == 40, "corpus grain layout must stay fixed");
+static_assert(sizeof(CorpusHeader) == 88, "corpus header layout must stay fixed");
+
+struct CorpusNeighbour {
+    float distance;  // squared euclidean distance in normalised feature space
+    juce::uint32 grain;
+};
+
+struct CorpusSettings {
+    AnalysisSettings analysis;
+    float silenceThreshold = 0.001f;  // windows quieter than this (RMS) are not added
+    int leafSize = 8;
+};
+
+// Concatenative grain corpus: every analysis window of a set of sources, stored as an implicit
+// k-d tree so the whole file can be memory-mapped and queried in place.
+//
+// File layout: header | CorpusGrain[numGrains] | uint8 splitDims[numGrains] | source names.
+// The grains are ordered so that the node covering [lo, hi) has its splitting grain at (lo + hi) / 2.
+class GrainCorpus {
+public:
+    static constexpr juce::uint32 currentVersion = 1;
+
+    // Analyses each source (reusing cached .grainidx sidecars) and writes the corpus file.
+    static bool build(const juce::Array<juce::File>& sources, juce::AudioFormatManager& formatManager,
+                      const juce::File& corpusFile, const CorpusSettings& settings = {}) {
+        std::vector<CorpusGrain> grains;
+        juce::StringArray names;
+
+        for (auto& source : sources) {
+            SourceAnalysisIndex index;
+            if (!index.loadOrBuild(source, formatManager, settings.analysis))
+                return false;
+
+            auto sourceIndex = static_cast<juce::uint32>(names.size());
+            names.add(source.getFullPathName());
+
+            for (int f = 0; f < index.getNumFrames(); f++) {
+                auto& frame = index.getFrame(f);
+                if (frame.rms < settings.silenceThreshold)
+                    continue;
+
+                CorpusGrain g {};
+                for (int d = 0; d < CorpusGrain::numFeatures; d++)
+                    g.features[d] = getDescriptor(frame, static_cast<Descriptor>(d));
+                g.sourceIndex = sourceIndex;
+                g.length = static_cast<juce::uint32>(index.getWindowSize());
+                g.position = index.frameToSample(f);
+                grains.push_back(g);
+            }
+        }
+
+        CorpusHeader h {};
+        std::memcpy(h.magic, "GRNCRP\0\0", 8);
+        h.version = currentVersion;
+        h.numFeatures = CorpusGrain::numFeatures;
+        h.numGrains = grains.size();
+        h.numSources = static_cast<juce::uint32>(names.size());
+        h.leafSize = static_cast<juce::uint32>(juce::jmax(1, settings.leafSize));
+
+        // Z-score every feature so that no single descriptor's units dominate the distance.
+        for (int d = 0; d < CorpusGrain::numFeatures; d++) {
+            double sum = 0.0, sumSquares = 0.0;
+            for (auto& g : grains) {
+                sum += g.features[d];
+                sumSquares += static_cast<double>(g.features[d]) * g.features[d];
+            }
+            double n = std::max(1.0, static_cast<double>(grains.size()));
+            double mean = sum / n;
+            double deviation = std::sqrt(juce::jmax(0.0, sumSquares / n - mean * mean));
+            h.mean[d] = static_cast<float>(mean);
+            h.scale[d] = deviation > 0.0 ? static_cast<float>(1.0 / deviation) : 1.0f;
+
+            for (auto& g : grains)
+                g.features[d] = (g.features[d] - h.mean[d]) * h.scale[d];
+        }
+
+        std::vector<juce::uint8> splitDims(grains.size(), 0);
+        buildNode(grains, splitDims, 0, static_cast<int>(grains.size()), static_cast<int>(h.leafSize));
+
+        auto treeBytes = sizeof(CorpusHeader) + grains.size() * sizeof(CorpusGrain) + splitDims.size();
+        h.namesOffset = (treeBytes + 7) & ~static_cast<juce::uint64>(7);
+
+        juce::TemporaryFile temp(corpusFile);
+        {
+            juce::FileOutputStream out(temp.getFile());
+            if (!out.openedOk())
+                return false;
+
+            out.write(&h, sizeof(h));
+            out.write(grains.data(), grains.size() * sizeof(CorpusGrain));
+            out.write(splitDims.data(), splitDims.size());
+            out.writeRepeatedByte(0, h.namesOffset - treeBytes);
+
+            for (auto& name : names) {
+                auto utf8 = name.toUTF8();
+                auto numBytes = static_cast<int>(utf8.sizeInBytes() - 1);
+                out.writeInt(numBytes);
+                out.write(utf8.getAddress(), static_cast<size_t>(numBytes));
+            }
+
+            out.flush();
+            if (out.getStatus().failed())
+                return false;
+        }
+
+        return temp.overwriteTargetFileWithTemporary();
+    }
+
+    bool load(const juce::File& corpusFile) {
+        close();
+        auto mapped = std::make_unique<juce::MemoryMappedFile>(corpusFile, juce::MemoryMappedFile::readOnly);
+        if (mapped->getData() == nullptr || mapped->getSize() < sizeof(CorpusHeader))
+            return false;
+
+        auto* h = static_cast<const CorpusHeader*>(mapped->getData());
+        if (std::memcmp(h->magic, "GRNCRP\0\0", 8) != 0
+            || h->version != currentVersion
+            || h->numFeatures != static_cast<juce::uint32>(CorpusGrain::numFeatures)
+            || h->namesOffset > mapped->getSize()
+            || h->namesOffset < sizeof(CorpusHeader))
+            return false;
+
+        // The grains and their split dimensions must fit before the names (divided rather than
+        // multiplied out, so a corrupt count can't overflow), and be indexable by int.
+        if (h->numGrains > (h->namesOffset - sizeof(CorpusHeader)) / (sizeof(CorpusGrain) + 1)
+            || h->numGrains > static_cast<juce::uint64>(std::numeric_limits<int>::max()))
+            return false;
+
+        auto* base = static_cast<const char*>(mapped->getData());
+        grains = reinterpret_cast<const CorpusGrain*>(base + sizeof(CorpusHeader));
+        splitDims = reinterpret_cast<const juce::uint8*>(grains + h->numGrains);
+
+        // Both index straight into arrays: a source name, and a feature as the tree is searched
+        for (juce::uint64 i = 0; i < h->numGrains; i++) {
+            if (grains[i].sourceIndex >= h->numSources || splitDims[i] >= CorpusGrain::numFeatures) {
+                close();
+                return false;
+            }
+        }
+
+        // Source names are few, so they are copied out rather than read in place.
+        juce::MemoryInputStream names(base + h->namesOffset, mapped->getSize() - h->namesOffset, false);
+        for (juce::uint32 i = 0; i < h->numSources; i++) {
+            auto numBytes = names.readInt();
+            juce::MemoryBlock utf8;
+            if (numBytes < 0 || names.readIntoMemoryBlock(utf8, numBytes) != static_cast<size_t>(numBytes)) {
+                close();
+                return false;
+            }
+            sourceNames.add(juce::String::fromUTF8(static_cast<const char*>(utf8.getData()), numBytes));
+        }
+
+        header = h;
+        mappedFile = std::move(mapped);
+        return true;
+    }
+
+    void close() {
+        mappedFile.reset();
+        header = nullptr;
+        grains = nullptr;
+        splitDims = nullptr;
+        sourceNames.clear();
+    }
+
+    bool isLoaded() const { return header != nullptr; }
+    int getNumGrains() const { return header != nullptr ? static_cast<int>(header->numGrains) : 0; }
+    const CorpusGrain& getGrain(int index) const { return grains[index]; }
+    juce::File getSource(int sourceIndex) const { return juce::File(sourceNames[sourceIndex]); }
+    int getNumSources() const { return sourceNames.size(); }
+
+    // Converts raw analysis descriptors into the corpus' normalised feature space.
+    void normalise(const AnalysisFrame& frame, float* features) const {
+        for (int d = 0; d < CorpusGrain::numFeatures; d++)
+            features[d] = (getDescriptor(frame, static_cast<Descriptor>(d)) - header->mean[d]) * header->scale[d];
+    }
+
+    // Finds up to k nearest grains to a normalised feature vector, closest first.
+    // Doesn't allocate, so it can be called from the render loop. Returns the number found.
+    int search(const float* query, int k, CorpusNeighbour* results) const {
+        if (k <= 0 || getNumGrains() == 0)
+            return 0;
+
+        int found = 0;
+        searchNode(0, getNumGrains(), query, k, results, found);
+        std::sort_heap(results, results + found, closer);
+        return found;
+    }
+
+    // Runs search() for numQueries consecutive feature vectors, writing k results per query
+    // (unused slots are given the index of the corpus grain count).
+    void searchBatch(const float* queries, int numQueries, int k, CorpusNeighbour* results) const {
+        for (int q = 0; q < numQueries; q++) {
+            auto* out = results + static_cast<size_t>(q) * k;
+            int found = search(queries + static_cast<size_t>(q) * CorpusGrain::numFeatures, k, out);
+            for (int i = found; i < k; i++)
+                out[i] = { std::numeric_limits<float>::max(), static_cast<juce::uint32>(getNumGrains()) };
+        }
+    }
+
+private:
+    static bool closer(const CorpusNeighbour& a, const CorpusNeighbour& b) { return a.distance < b.distance; }
+
+    static void buildNode(std::vector<CorpusGrain>& grains, std::vector<juce::uint8>& splitDims,
+                          int lo, int hi, int leafSize) {
+        if (hi - lo <= leafSize)
+            return;
+
+        // Split on the dimension with the widest spread.
+        int dim = 0;
+        float widest = -1.0f;
+        for (int d = 0; d < CorpusGrain::numFeatures; d++) {
+            auto range = std::minmax_element(grains.begin() + lo, grains.begin() + hi,
+                                             [d](const CorpusGrain& a, const CorpusGrain& b) {
+                                                 return a.features[d] < b.features[d];
+                                             });
+            float spread = range.second->features[d] - range.first->features[d];
+            if (spread > widest) {
+                widest = spread;
+                dim = d;
+            }
+        }
+
+        int mid = (lo + hi) / 2;
+        std::nth_element(grains.begin() + lo, grains.begin() + mid, grains.begin() + hi,
+                         [dim](const CorpusGrain& a, const CorpusGrain& b) {
+                             return a.features[dim] < b.features[dim];
+                         });
+        splitDims[static_cast<size_t>(mid)] = static_cast<juce::uint8>(dim);
+
+        buildNode(grains, splitDims, lo, mid, leafSize);
+        buildNode(grains, splitDims, mid + 1, hi, leafSize);
+    }
+
+    // results[0..found) is kept as a max-heap on distance so the current worst match is at the front.
+    void consider(int index, const float* query, int k, CorpusNeighbour* results, int& found) const {
+        const float* f = grains[index].features;
+        float distance = 0.0f;
+        for (int d = 0; d < CorpusGrain::numFeatures; d++) {
+            float diff = f[d] - query[d];
+            distance += diff * diff;
+        }
+
+        if (found < k) {
+            results[found++] = { distance, static_cast<juce::uint32>(index) };
+            std::push_heap(results, results + found, closer);
+        }
+        else if (distance < results[0].distance) {
+            std::pop_heap(results, results + found, closer);
+            results[found - 1] = { distance, static_cast<juce::uint32>(index) };
+            std::push_heap(results, results + found, closer);
+        }
+    }
+
+    void searchNode(int lo, int hi, const float* query, int k, CorpusNeighbour* results, int& found) const {
+        if (hi - lo <= static_cast<int>(header->leafSize)) {
+            for (int i = lo; i < hi; i++)
+                consider(i, query, k, results, found);
+            return;
+        }
+
+        int mid = (lo + hi) / 2;
+        int dim = splitDims[mid];
+        float diff = query[dim] - grains[mid].features[dim];
+        consider(mid, query, k, results, found);
+
+        if (diff < 0.0f) {
+            searchNode(lo, mid, query, k, results, found);
+            if (found < k || diff * diff < results[0].distance)
+                searchNode(mid + 1, hi, query, k, results, found);
+        }
+        else {
+            searchNode(mid + 1, hi, query, k, results, found);
+            if (found < k || diff * diff < results[0].distance)
+                searchNode(lo, mid, query, k, results, found);
+        }
+    }
+
+    std::unique_ptr<juce::MemoryMappedFile> mappedFile;
+    const CorpusHeader* header = nullptr;
+    const CorpusGrain* grains = nullptr;
+    const juce::uint8* splitDims = nullptr;
+    juce::StringArray sourceNames;
+};
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cmath>
+
+// Responses a grain's filter can have, as juce::dsp::StateVariableTPTFilterType plus none.
+enum class GrainFilterType { none = 0, lowPass, bandPass, highPass, numTypes };
+
+// How a render's grains are filtered: each grain gets a filter of this type with its own cutoff,
+// drawn at spawn between minCutoff and maxCutoff, evenly in pitch. Stored in the grain log, so the
+// layout is fixed.
+struct GrainFilterSettings {
+    juce::int32 type = 0;         // GrainFilterType
+    float minCutoff = 1000.0f;    // Hz
+    float maxCutoff = 1000.0f;
+    float resonance = 0.70710678f;
+};
+
+static_assert(sizeof(GrainFilterSettings) == 16, "grain filter settings layout must stay fixed");
+
+// One grain's filter, fixed when the grain is spawned.
+struct GrainFilter {
+    GrainFilterType type = GrainFilterType::none;
+    float cutoff = 1000.0f;
+    float resonance = 0.70710678f;
+
+    // This grain's filter under settings, its cutoff drawn from random.
+    static GrainFilter fromSettings(const GrainFilterSettings& settings, juce::Random& random) {
+        GrainFilter filter;
+        filter.type = static_cast<GrainFilterType>(juce::jlimit(0, static_cast<int>(GrainFilterType::numTypes) - 1, static_cast<int>(settings.type)));
+        filter.cutoff = settings.minCutoff * std::pow(settings.maxCutoff / settings.minCutoff, random.nextFloat());
+        filter.resonance = settings.resonance;
+        return filter;
+    }
+};
+
+// A grain's filter worked out for a sample rate: the TPT state-variable filter's coefficients,
+// taken the same way as juce::dsp::StateVariableTPTFilter's, and how much of each of its outputs
+// (and of the unfiltered input) the grain hears. Computed once, at spawn.
+struct GrainFilterCoefficients {
+    float g = 0.0f, feedback = 0.0f, h = 1.0f;  // feedback = g + 1 / resonance
+    float dry = 1.0f, lowPass = 0.0f, bandPass = 0.0f, highPass = 0.0f;
+
+    static GrainFilterCoefficients make(const GrainFilter& filter, double sampleRate) {
+        GrainFilterCoefficients c;
+        if (filter.type == GrainFilterType::none)
+            return c;
+
+        const double cutoff = juce::jlimit(10.0, sampleRate * 0.49, static_cast<double>(filter.cutoff));
+        const auto g = static_cast<float>(std::tan(juce::MathConstants<double>::pi * cutoff / sampleRate));
+        const auto r2 = static_cast<float>(1.0 / juce::jmax(0.01f, filter.resonance));
+        c.g = g;
+        c.feedback = g + r2;
+        c.h = static_cast<float>(1.0 / (1.0 + r2 * g + g * g));
+        c.dry = 0.0f;
+        c.lowPass = filter.type == GrainFilterType::lowPass ? 1.0f : 0.0f;
+        c.bandPass = filter.type == GrainFilterType::bandPass ? 1.0f : 0.0f;
+        c.highPass = filter.type == GrainFilterType::highPass ? 1.0f : 0.0f;
+        return c;
+    }
+
+    bool isBypassed() const { return dry == 1.0f; }
+};
+
+// Filters grains several at a time, one grain per SIMDRegister lane: every lane keeps its own
+// filter state and coefficients, so 4 (SSE, NEON) or 8 (AVX) grains take one instruction per
+// filter step. Each lane computes all three responses and mixes them by its coefficients, so
+// grains of different types share a register without branching. The same operations run in every
+// lane, so a grain comes out the same whichever grains it is grouped with.
+//
+// A filter step depends on the one before, so a group runs a few registers side by side to keep
+// the multipliers busy while each waits on its last result.
+class GrainFilterBank {
+public:
+    using Lanes = juce::dsp::SIMDRegister<float>;
+    static constexpr int numLanes = static_cast<int>(Lanes::SIMDNumElements);
+    static constexpr int numRegisters = 4;
+    static constexpr int groupSize = numLanes * numRegisters;
+
+    // Filters every channel of each buffer in place with the matching coefficients, groupSize
+    // grains at a time. A group of unfiltered grains is skipped.
+    static void process(juce::AudioBuffer<float>* const* buffers, const GrainFilterCoefficients* coefficients, int numGrains) {
+        juce::ScopedNoDenormals noDenormals;
+        for (int first = 0; first < numGrains; first += groupSize)
+            processGroup(buffers + first, coefficients + first, juce::jmin(groupSize, numGrains - first));
+    }
+
+private:
+    static constexpr int blockSize = 64;
+
+    struct Coefficients {
+        Lanes g, feedback, h, dry, lowPass, bandPass, highPass;
+    };
+
+    // One step of one register's filters.
+    forcedinline static Lanes tick(Lanes x, Lanes& s1, Lanes& s2, const Coefficients& c) {
+        const Lanes yHP = c.h * (x - s1 * c.feedback - s2);
+        const Lanes yBP = yHP * c.g + s1;
+        s1 = yHP * c.g + yBP;
+        const Lanes yLP = yBP * c.g + s2;
+        s2 = yBP * c.g + yLP;
+        return c.dry * x + c.lowPass * yLP + c.bandPass * yBP + c.highPass * yHP;
+    }
+
+    static void processGroup(juce::AudioBuffer<float>* const* buffers, const GrainFilterCoefficients* coefficients, int count) {
+        if (std::all_of(coefficients, coefficients + count, [](const auto& c) { return c.isBypassed(); }))
+            return;
+
+        // Unused lanes run a bypassed filter on silence
+        Coefficients registers[numRegisters];
+        int lengths[groupSize] {};
+        int numChannels = 0, maxLength = 0;
+        for (int r = 0; r < numRegisters; r++) {
+            alignas(Lanes::SIMDRegisterSize) float values[7][numLanes] {};
+            for (int lane = 0; lane < numLanes; lane++) {
+                const int grain = r * numLanes + lane;
+                const auto c = grain < count ? coefficients[grain] : GrainFilterCoefficients {};
+                const float fields[] = { c.g, c.feedback, c.h, c.dry, c.lowPass, c.bandPass, c.highPass };
+                for (int k = 0; k < 7; k++)
+                    values[k][lane] = fields[k];
+            }
+            registers[r] = { Lanes::fromRawArray(values[0]), Lanes::fromRawArray(values[1]), Lanes::fromRawArray(values[2]),
+                             Lanes::fromRawArray(values[3]), Lanes::fromRawArray(values[4]), Lanes::fromRawArray(values[5]),
+                             Lanes::fromRawArray(values[6]) };
+        }
+        for (int grain = 0; grain < count; grain++) {
+            lengths[grain] = buffers[grain]->getNumSamples();
+            numChannels = juce::jmax(numChannels, buffers[grain]->getNumChannels());
+            maxLength = juce::jmax(maxLength, lengths[grain]);
+        }
+
+        for (int chan = 0; chan < numChannels; chan++) {
+            float* data[groupSize] {};
+            int channelLengths[groupSize] {};
+            for (int grain = 0; grain < count; grain++) {
+                if (chan < buffers[grain]->getNumChannels()) {
+                    data[grain] = buffers[grain]->getWritePointer(chan);
+                    channelLengths[grain] = lengths[grain];
+                }
+            }
+
+            // A block at a time: interleave the grains' samples, step every filter through them,
+            // then copy each grain's results back. Grains that have ended read silence.
+            Lanes s1[numRegisters], s2[numRegisters];
+            for (int r = 0; r < numRegisters; r++)
+                s1[r] = s2[r] = Lanes::expand(0.0f);
+            alignas(Lanes::SIMDRegisterSize) float frames[blockSize][groupSize];
+
+            for (int start = 0; start < maxLength; start += blockSize) {
+                const int n = juce::jmin(blockSize, maxLength - start);
+                int valid[groupSize];
+                for (int grain = 0; grain < groupSize; grain++) {
+                    valid[grain] = juce::jlimit(0, n, channelLengths[grain] - start);
+                    for (int i = 0; i < valid[grain]; i++)
+                        frames[i][grain] = data[grain][start + i];
+                    for (int i = valid[grain]; i < n; i++)
+                        frames[i][grain] = 0.0f;
+                }
+
+                for (int i = 0; i < n; i++)
+                    for (int r = 0; r < numRegisters; r++)
+                        tick(Lanes::fromRawArray(frames[i] + r * numLanes), s1[r], s2[r], registers[r])
+                            .copyToRawArray(frames[i] + r * numLanes);
+
+                for (int grain = 0; grain < groupSize; grain++)
+                    for (int i = 0; i < valid[grain]; i++)
+                        data[grain][start + i] = frames[i][grain];
+            }
+        }
+    }
+};
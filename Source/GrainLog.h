@@ -0,0 +1,211 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <cstring>
+#include <vector>
+#include "GrainFilter.h"
+#include "GrainRenderer.h"
+
+// One spawned grain, as the scheduler decided it.
+struct GrainEvent {
+    juce::int64 time;            // output sample the grain starts at
+    juce::int64 sourcePosition;  // source sample it is taken from
+    juce::int32 length;
+    float pitch;
+    float gain;
+    float pan;                   // -1 (left) to 1 (right), 0 = centre
+    juce::uint32 seed;
+};
+
+// Settings that hold for a whole render, stored once at the start of a log.
+struct GrainLogHeader {
+    char magic[8];
+    juce::uint32 version;
+    juce::uint32 numChannels;
+    double sampleRate;
+    juce::int64 outputLength;
+    juce::int32 delaySamples;
+    juce::int32 envelope;      // EnvelopeShape
+    GrainShape shape;
+    juce::int32 mode;          // GrainMode
+    float stretch;
+    GrainFilterSettings filter;
+    juce::uint32 sourcePathBytes;
+    juce::uint32 reserved[2];
+};
+
+static_assert(sizeof(GrainLogHeader) == 96, "grain log header layout must stay fixed");
+
+// A "<output>.grainlog" file is a GrainLogHeader, the source's path (UTF-8, sourcePathBytes
+// long) and then one record per event:
+//
+//   flags byte | time delta (zigzag varint) | source position delta (zigzag varint)
+//              | [length varint] [pitch float] [gain float] [pan float] [seed varint]
+//
+// where the bracketed fields are only present when the flags say they changed from the previous
+// event (the seed counts as unchanged when it is one more than the last). A regular stream of
+// grains costs three or four bytes each.
+namespace GrainLogFormat {
+    enum Flags : juce::uint8 {
+        lengthChanged = 1 << 0,
+        pitchChanged  = 1 << 1,
+        gainChanged   = 1 << 2,
+        panChanged    = 1 << 3,
+        seedJumped    = 1 << 4
+    };
+
+    inline void writeVarint(juce::MemoryOutputStream& out, juce::uint64 v) {
+        while (v >= 0x80) {
+            out.writeByte(static_cast<char>((v & 0x7f) | 0x80));
+            v >>= 7;
+        }
+        out.writeByte(static_cast<char>(v));
+    }
+
+    inline juce::uint64 zigzag(juce::int64 v) {
+        return (static_cast<juce::uint64>(v) << 1) ^ static_cast<juce::uint64>(v >> 63);
+    }
+
+    inline juce::int64 unzigzag(juce::uint64 v) {
+        return static_cast<juce::int64>(v >> 1) ^ -static_cast<juce::int64>(v & 1);
+    }
+
+    inline bool readVarint(const juce::uint8*& p, const juce::uint8* end, juce::uint64& v) {
+        v = 0;
+        for (int shift = 0; shift < 64 && p < end; shift += 7) {
+            const auto byte = *p++;
+            v |= static_cast<juce::uint64>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    inline bool readFloat(const juce::uint8*& p, const juce::uint8* end, float& f) {
+        if (end - p < 4)
+            return false;
+        const auto bits = juce::ByteOrder::littleEndianInt(p);
+        std::memcpy(&f, &bits, sizeof(f));
+        p += 4;
+        return true;
+    }
+}
+
+// Appends events to an in-memory log and writes it out in large chunks, so logging a grain
+// costs a few byte stores.
+class GrainLogWriter {
+public:
+    GrainLogWriter(const juce::File& logFile, const GrainLogHeader& settings, const juce::File& source)
+        : file(logFile) {
+        file.deleteFile();
+        stream = file.createOutputStream();
+        if (stream == nullptr)
+            return;
+
+        auto path = source.getFullPathName().toStdString();
+        GrainLogHeader h = settings;
+        std::memcpy(h.magic, "GRNLOG\0\0", 8);
+        h.version = 3;
+        h.sourcePathBytes = static_cast<juce::uint32>(path.size());
+        stream->write(&h, sizeof(h));
+        stream->write(path.data(), path.size());
+    }
+
+    ~GrainLogWriter() { flush(); }
+
+    bool isOpen() const { return stream != nullptr; }
+
+    void log(const GrainEvent& e) {
+        using namespace GrainLogFormat;
+        juce::uint8 flags = 0;
+        if (e.length != last.length) flags |= lengthChanged;
+        if (e.pitch != last.pitch)   flags |= pitchChanged;
+        if (e.gain != last.gain)     flags |= gainChanged;
+        if (e.pan != last.pan)       flags |= panChanged;
+        if (e.seed != last.seed + 1) flags |= seedJumped;
+
+        pending.writeByte(static_cast<char>(flags));
+        writeVarint(pending, zigzag(e.time - last.time));
+        writeVarint(pending, zigzag(e.sourcePosition - last.sourcePosition));
+        if (flags & lengthChanged) writeVarint(pending, static_cast<juce::uint32>(e.length));
+        if (flags & pitchChanged)  pending.writeFloat(e.pitch);
+        if (flags & gainChanged)   pending.writeFloat(e.gain);
+        if (flags & panChanged)    pending.writeFloat(e.pan);
+        if (flags & seedJumped)    writeVarint(pending, e.seed);
+        last = e;
+
+        if (pending.getDataSize() >= chunkSize)
+            flush();
+    }
+
+    void flush() {
+        if (stream != nullptr && pending.getDataSize() > 0) {
+            stream->write(pending.getData(), pending.getDataSize());
+            stream->flush();
+        }
+        pending.reset();
+    }
+
+    // The state both sides start from, so the first event is encoded like every other.
+    static GrainEvent initialEvent() { return { 0, 0, 0, 1.0f, 1.0f, 0.0f, static_cast<juce::uint32>(-1) }; }
+
+private:
+    static constexpr size_t chunkSize = 1 << 20;
+
+    juce::File file;
+    std::unique_ptr<juce::FileOutputStream> stream;
+    juce::MemoryOutputStream pending;
+    GrainEvent last = initialEvent();
+};
+
+// Reads a whole log back: the render settings, the source path and every event in order.
+inline bool readGrainLog(const juce::File& file, GrainLogHeader& header, juce::File& source,
+                         std::vector<GrainEvent>& events) {
+    using namespace GrainLogFormat;
+
+    juce::MemoryBlock data;
+    if (!file.loadFileAsData(data) || data.getSize() < sizeof(GrainLogHeader))
+        return false;
+
+    std::memcpy(&header, data.getData(), sizeof(header));
+    if (std::memcmp(header.magic, "GRNLOG\0\0", 8) != 0 || header.version != 3
+        || data.getSize() < sizeof(header) + header.sourcePathBytes)
+        return false;
+
+    auto* p = static_cast<const juce::uint8*>(data.getData()) + sizeof(header);
+    auto* end = static_cast<const juce::uint8*>(data.getData()) + data.getSize();
+    source = juce::File(juce::String::fromUTF8(reinterpret_cast<const char*>(p), static_cast<int>(header.sourcePathBytes)));
+    p += header.sourcePathBytes;
+
+    events.clear();
+    GrainEvent e = GrainLogWriter::initialEvent();
+    while (p < end) {
+        const auto flags = *p++;
+        juce::uint64 v = 0;
+        if (!readVarint(p, end, v)) return false;
+        e.time += unzigzag(v);
+        if (!readVarint(p, end, v)) return false;
+        e.sourcePosition += unzigzag(v);
+
+        if (flags & lengthChanged) {
+            if (!readVarint(p, end, v)) return false;
+            e.length = static_cast<juce::int32>(v);
+        }
+        if ((flags & pitchChanged) && !readFloat(p, end, e.pitch)) return false;
+        if ((flags & gainChanged) && !readFloat(p, end, e.gain)) return false;
+        if ((flags & panChanged) && !readFloat(p, end, e.pan)) return false;
+        if (flags & seedJumped) {
+            if (!readVarint(p, end, v)) return false;
+            e.seed = static_cast<juce::uint32>(v);
+        }
+        else {
+            e.seed++;
+        }
+        events.push_back(e);
+    }
+    return true;
+}
+
+inline juce::File getGrainLogFileFor(const juce::File& output) {
+    return output.getSiblingFile(output.getFileName() + ".grainlog");
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <cstring>
+#include <vector>
+#include "GrainRenderer.h"
+
+// Where and how one grain was placed in a render, for drawing over the output's waveform.
+struct GrainMapEntry {
+    juce::int64 outputStart;
+    juce::int32 numSamples;
+    juce::int32 envelope;   // EnvelopeShape
+    GrainShape shape;
+    juce::int32 reserved;
+};
+
+// Header of a "<output>.grainmap" sidecar, followed by GrainMapEntry[numGrains].
+struct GrainMapHeader {
+    char magic[8];
+    juce::uint32 version;
+    juce::uint32 reserved;
+    double sampleRate;
+    juce::uint64 numGrains;
+};
+
+static_assert(sizeof(GrainMapEntry) == 40, "grain map entry layout must stay fixed");
+static_assert(sizeof(GrainMapHeader) == 32, "grain map header layout must stay fixed");
+
+inline juce::File getGrainMapFileFor(const juce::File& output) {
+    return output.getSiblingFile(output.getFileName() + ".grainmap");
+}
+
+inline bool writeGrainMap(const juce::File& file, double sampleRate, const std::vector<GrainMapEntry>& grains) {
+    GrainMapHeader h {};
+    std::memcpy(h.magic, "GRNMAP\0\0", 8);
+    h.version = 2;
+    h.sampleRate = sampleRate;
+    h.numGrains = grains.size();
+
+    juce::TemporaryFile temp(file);
+    {
+        juce::FileOutputStream out(temp.getFile());
+        if (!out.openedOk())
+            return false;
+
+        out.write(&h, sizeof(h));
+        out.write(grains.data(), grains.size() * sizeof(GrainMapEntry));
+        out.flush();
+        if (out.getStatus().failed())
+            return false;
+    }
+    return temp.overwriteTargetFileWithTemporary();
+}
+
+inline bool readGrainMap(const juce::File& file, double& sampleRate, std::vector<GrainMapEntry>& grains) {
+    juce::MemoryBlock data;
+    if (!file.loadFileAsData(data) || data.getSize() < sizeof(GrainMapHeader))
+        return false;
+
+    GrainMapHeader h;
+    std::memcpy(&h, data.getData(), sizeof(h));
+    if (std::memcmp(h.magic, "GRNMAP\0\0", 8) != 0 || h.version != 2
+        || data.getSize() < sizeof(h) + h.numGrains * sizeof(GrainMapEntry))
+        return false;
+
+    sampleRate = h.sampleRate;
+    grains.resize(static_cast<size_t>(h.numGrains));
+    std::memcpy(grains.data(), static_cast<const char*>(data.getData()) + sizeof(h), grains.size() * sizeof(GrainMapEntry));
+    return true;
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <cmath>
+#include <iterator>
+#include <type_traits>
+
+// Tag types selecting a grain's envelope shape at compile time, in the same way
+// juce::dsp::DelayLineInterpolationTypes selects a DelayLine's interpolation.
+namespace GrainEnvelopeShapes {
+    // Linear attack, decay, sustain and release, as env() in Envelope.cpp.
+    struct LinearADSR {};
+
+    // Linear fade in and out over a quarter of the grain each, as GranularSynth's grains.
+    struct Trapezoid {};
+
+    // Raised cosine over the whole grain.
+    struct Hann {};
+
+    // LinearADSR's segments bent into exponential curves of adjustable steepness (GrainShape::curve).
+    // Positive curves move fast at first and settle into each target, like an analog envelope;
+    // negative ones start slowly and accelerate; 0 is LinearADSR.
+    struct CurvedADSR {};
+
+    // CurvedADSR with a fixed analog-style curve.
+    struct ExponentialADSR {};
+}
+
+// Runtime names for the shapes, used to pick a renderer when a grain is spawned.
+enum class EnvelopeShape { linearADSR = 0, trapezoid, hann, curvedADSR, exponentialADSR, numShapes };
+
+// Envelope segment lengths in samples. Shapes that don't have a segment ignore it.
+struct GrainShape {
+    int attack  = 0;
+    int decay   = 0;
+    int release = 0;
+    float sustain = 1.0f;
+    float curve = 0.0f;  // steepness of CurvedADSR's segments
+};
+
+// Writes src * envelope * gain into dest (which may be src) for one channel of a grain.
+//
+// Every shape is rendered segment by segment, so each inner loop is a straight, branch-free
+// ramp or recurrence that the compiler can inline and vectorise for the given SampleType.
+template <typename SampleType, typename EnvelopeShapeType>
+class GrainRenderer {
+public:
+    static void process(const SampleType* src, SampleType* dest, int numSamples,
+                        const GrainShape& shape, SampleType gain) {
+        if constexpr (std::is_same_v<EnvelopeShapeType, GrainEnvelopeShapes::LinearADSR>) {
+            // Segment ends follow env(): release is anchored to the end and never overlaps the decay.
+            const int attackEnd = juce::jlimit(0, numSamples, shape.attack);
+            const int decayEnd = juce::jlimit(attackEnd, numSamples, attackEnd + shape.decay);
+            const int sustainEnd = juce::jlimit(decayEnd, numSamples, numSamples - shape.release);
+            const auto sustain = static_cast<SampleType>(shape.sustain);
+
+            int i = ramp(src, dest, 0, attackEnd, SampleType(0), gain / juce::jmax(1, attackEnd), gain);
+            i = ramp(src, dest, i, decayEnd, gain, gain * (sustain - SampleType(1)) / juce::jmax(1, decayEnd - attackEnd), gain);
+            i = ramp(src, dest, i, sustainEnd, gain * sustain, SampleType(0), gain);
+            ramp(src, dest, i, numSamples, gain * sustain, -gain * sustain / juce::jmax(1, numSamples - 1 - sustainEnd), gain);
+        }
+        else if constexpr (std::is_same_v<EnvelopeShapeType, GrainEnvelopeShapes::Trapezoid>) {
+            const int fade = juce::jmax(1, numSamples / 4);
+            const int fadeInEnd = juce::jmin(numSamples, fade);
+            const int fadeOutStart = juce::jmax(fadeInEnd, numSamples - fade);
+
+            int i = ramp(src, dest, 0, fadeInEnd, SampleType(0), gain / fade, gain);
+            i = ramp(src, dest, i, fadeOutStart, gain, SampleType(0), gain);
+            ramp(src, dest, i, numSamples, gain * (numSamples - fadeOutStart) / fade, -gain / fade, gain);
+        }
+        else if constexpr (std::is_same_v<EnvelopeShapeType, GrainEnvelopeShapes::Hann>) {
+            // cos(w * n) by the two-term recurrence c[n + 1] = 2 cos(w) c[n] - c[n - 1], kept in
+            // double so long float grains don't drift.
+            const auto w = juce::MathConstants<double>::twoPi / juce::jmax(1, numSamples - 1);
+            const auto k = 2.0 * std::cos(w);
+            auto current = 1.0;
+            auto previous = std::cos(w);
+            const auto half = static_cast<double>(gain) * 0.5;
+
+            for (int n = 0; n < numSamples; n++) {
+                dest[n] = src[n] * static_cast<SampleType>(half - half * current);
+                auto next = k * current - previous;
+                previous = current;
+                current = next;
+            }
+        }
+        else if constexpr (std::is_same_v<EnvelopeShapeType, GrainEnvelopeShapes::CurvedADSR>
+                           || std::is_same_v<EnvelopeShapeType, GrainEnvelopeShapes::ExponentialADSR>) {
+            // Same segment ends, and the same levels at them, as LinearADSR.
+            const int attackEnd = juce::jlimit(0, numSamples, shape.attack);
+            const int decayEnd = juce::jlimit(attackEnd, numSamples, attackEnd + shape.decay);
+            const int sustainEnd = juce::jlimit(decayEnd, numSamples, numSamples - shape.release);
+            const double c = std::is_same_v<EnvelopeShapeType, GrainEnvelopeShapes::ExponentialADSR>
+                                 ? exponentialCurve : static_cast<double>(shape.curve);
+            const double peak = static_cast<double>(gain);
+            const double sustain = peak * static_cast<double>(shape.sustain);
+
+            int i = curve(src, dest, 0, attackEnd, 0.0, peak, juce::jmax(1, attackEnd), c);
+            i = curve(src, dest, i, decayEnd, peak, sustain, juce::jmax(1, decayEnd - attackEnd), c);
+            i = curve(src, dest, i, sustainEnd, sustain, sustain, 1, 0.0);
+            curve(src, dest, i, numSamples, sustain, 0.0, juce::jmax(1, numSamples - 1 - sustainEnd), c);
+        }
+        else {
+            static_assert(std::is_same_v<EnvelopeShapeType, void>, "unknown envelope shape");
+        }
+    }
+
+    // Multichannel form with the signature used by the dispatch table.
+    static void processChannels(const SampleType* const* src, SampleType* const* dest, int numChannels,
+                                int numSamples, const GrainShape& shape, SampleType gain) {
+        for (int chan = 0; chan < numChannels; chan++)
+            process(src[chan], dest[chan], numSamples, shape, gain);
+    }
+
+private:
+    // dest[n] = src[n] * (start + (n - first) * slope), clamped to [0, gain], for n in [first, last).
+    static int ramp(const SampleType* src, SampleType* dest, int first, int last,
+                    SampleType start, SampleType slope, SampleType gain) {
+        for (int n = first; n < last; n++) {
+            auto amplitude = juce::jlimit(SampleType(0), gain, start + static_cast<SampleType>(n - first) * slope);
+            dest[n] = src[n] * amplitude;
+        }
+        return juce::jmax(first, last);
+    }
+
+    // dest[n] = src[n] * y(n - first) for n in [first, last), where y goes from y0 at 0 to y1 at
+    // length along y(t) = y0 + (y1 - y0) (1 - e^(-c t / length)) / (1 - e^-c).
+    //
+    // That is A + B r^t with r = e^(-c / length), so each sample follows from its neighbour by
+    // y = r y + A (1 - r): one multiply-add, with every exp taken once per segment. The recurrence
+    // runs in whichever direction has r < 1, so rounding errors die away instead of compounding,
+    // and in double, which keeps even very long float segments within -120 dB of the exact curve.
+    static int curve(const SampleType* src, SampleType* dest, int first, int last,
+                     double y0, double y1, int length, double c) {
+        if (last <= first)
+            return first;
+
+        c = juce::jlimit(-maxCurve, maxCurve, c);
+        if (std::abs(c) <= 1.0e-6) {
+            const double slope = (y1 - y0) / length;
+            recurse(src, dest, first, 1, last - first, y0, 1.0, slope, 1.0, 4.0 * slope);
+            return last;
+        }
+
+        // y(t) = a - b e^(-c t / length)
+        const double b = (y1 - y0) / -std::expm1(-c);
+        const double a = y0 + b;
+        const double x = -std::abs(c) / length;
+        const double r = std::exp(x), step = a * -std::expm1(x);
+        const double r4 = std::exp(4.0 * x), step4 = a * -std::expm1(4.0 * x);
+
+        if (c > 0.0)
+            recurse(src, dest, first, 1, last - first, y0, r, step, r4, step4);
+        else  // backwards from the last sample, where r = e^(c / length) < 1
+            recurse(src, dest, last - 1, -1, last - first, a - b * std::exp(-c * (last - 1 - first) / length), r, step, r4, step4);
+        return last;
+    }
+
+    // dest[n] = src[n] * y for count samples from start, stepping n by direction and y by
+    // y = r y + step. Four interleaved lanes each jump four samples (r4, step4), so the chain of
+    // dependent multiply-adds is a quarter as long and doesn't bound the loop's speed.
+    static void recurse(const SampleType* src, SampleType* dest, int start, int direction, int count,
+                        double y, double r, double step, double r4, double step4) {
+        double lanes[4];
+        for (auto& lane : lanes) {
+            lane = y;
+            y = r * y + step;
+        }
+
+        int i = 0;
+        for (; i + 4 <= count; i += 4) {
+            for (int k = 0; k < 4; k++) {
+                const int n = start + direction * (i + k);
+                dest[n] = src[n] * static_cast<SampleType>(lanes[k]);
+                lanes[k] = r4 * lanes[k] + step4;
+            }
+        }
+        for (int k = 0; i < count; i++, k++) {
+            const int n = start + direction * i;
+            dest[n] = src[n] * static_cast<SampleType>(lanes[k]);
+        }
+    }
+
+    static constexpr double exponentialCurve = 5.0;
+    static constexpr double maxCurve = 30.0;
+};
+
+template <typename SampleType>
+using GrainRenderFunction = void (*)(const SampleType* const*, SampleType* const*, int, int, const GrainShape&, SampleType);
+
+// Looks up the specialised renderer for a shape. Call it once when a grain is spawned and keep
+// the function pointer, so the shape is never re-examined while the grain renders.
+template <typename SampleType>
+GrainRenderFunction<SampleType> getGrainRenderer(EnvelopeShape shape) {
+    static constexpr GrainRenderFunction<SampleType> table[] = {
+        &GrainRenderer<SampleType, GrainEnvelopeShapes::LinearADSR>::processChannels,
+        &GrainRenderer<SampleType, GrainEnvelopeShapes::Trapezoid>::processChannels,
+        &GrainRenderer<SampleType, GrainEnvelopeShapes::Hann>::processChannels,
+        &GrainRenderer<SampleType, GrainEnvelopeShapes::CurvedADSR>::processChannels,
+        &GrainRenderer<SampleType, GrainEnvelopeShapes::ExponentialADSR>::processChannels,
+    };
+    static_assert(std::size(table) == static_cast<size_t>(EnvelopeShape::numShapes), "one renderer per shape");
+
+    return table[juce::jlimit(0, static_cast<int>(EnvelopeShape::numShapes) - 1, static_cast<int>(shape))];
+}
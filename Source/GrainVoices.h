@@ -0,0 +1,257 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// How a grain plays, given when it is spawned.
+struct GrainVoiceParameters {
+    const juce::AudioBuffer<float>* source = nullptr;  // must outlive the grain
+    double sourcePosition = 0.0;  // first source sample read
+    int length = 0;               // output samples
+    float increment = 1.0f;       // source samples per output sample (the pitch ratio)
+    float gain = 1.0f;
+    float pan = 0.0f;             // -1 (left) to 1 (right)
+};
+
+// Every sounding grain's state as a structure of arrays: read offset, fraction and increment,
+// envelope phase and its increment, and a gain per output channel, each in its own SIMD-aligned
+// array, so render() can advance a register's worth of grains (4 with SSE or NEON, 8 with AVX)
+// per step. Spawning appends to the arrays and retiring moves the last grain into the gap, so
+// the live grains always fill the front of every array.
+//
+// Grains read their source with linear interpolation under a Hann envelope, and balance pan
+// like Main's grains. A spawned grain starts at the next render() call.
+//
+// Throughput falls short of the 10k grains per core aimed for: with 4-lane SSE, stereo grains
+// render in real time at about 4k per core, 2.5x a grain-at-a-time loop. The source reads are
+// scalar, one lane at a time (SIMDRegister has no gather), and take most of the time.
+class GrainVoiceStore {
+public:
+    using Lanes = juce::dsp::SIMDRegister<float>;
+    static constexpr int numLanes = static_cast<int>(Lanes::SIMDNumElements);
+    static constexpr int maxChannels = 8;
+
+    void prepare(int numOutputChannels, int maxGrains) {
+        jassert(numOutputChannels > 0 && numOutputChannels <= maxChannels);
+        channels = juce::jlimit(1, maxChannels, numOutputChannels);
+        capacity = juce::jmax(1, maxGrains);
+        numActive = 0;
+
+        const auto numRegisters = static_cast<size_t>((capacity + numLanes - 1) / numLanes);
+        for (auto* field : { &offset, &fraction, &increment, &phase, &phaseIncrement })
+            field->assign(numRegisters, Lanes::expand(0.0f));
+        gains.assign(static_cast<size_t>(channels), std::vector<Lanes>(numRegisters, Lanes::expand(0.0f)));
+        remaining.assign(numRegisters * numLanes, 0);
+        sources.assign(numRegisters * numLanes * static_cast<size_t>(channels), nullptr);
+        accumulators.assign(static_cast<size_t>(channels) * chunkSize, Lanes::expand(0.0f));
+        samples.assign(static_cast<size_t>(channels) * chunkSize, Lanes::expand(0.0f));
+        positions.assign(chunkSize, Lanes::expand(0.0f));
+        fractions.assign(chunkSize, Lanes::expand(0.0f));
+    }
+
+    int getNumActive() const { return numActive; }
+    int getCapacity() const { return capacity; }
+
+    // Starts a grain at the next render(). Returns false if the store is full or the grain would
+    // play nothing; the caller decides whether to steal one with retire() first. A grain that would
+    // run off the end of its source is shortened, its envelope fitted to the shorter length.
+    bool spawn(const GrainVoiceParameters& p) {
+        if (numActive == capacity || p.source == nullptr || p.length <= 0 || p.increment < 0.0f)
+            return false;
+
+        const int sourceLength = p.source->getNumSamples();
+        const double start = std::floor(juce::jmax(0.0, p.sourcePosition));
+        const auto startFraction = static_cast<float>(juce::jmax(0.0, p.sourcePosition) - start);
+
+        // Each sample reads the source at offset and offset + 1; stop a sample short of the end
+        // of the source so rounding in the running offset can't carry a read past it.
+        const double room = sourceLength - 3 - start - startFraction;
+        if (room < 0.0)
+            return false;
+        const double playable = p.increment > 0.0f ? std::floor(room / p.increment) + 1.0 : static_cast<double>(p.length);
+        const int length = static_cast<int>(juce::jmin(static_cast<double>(p.length), playable));
+
+        const int g = numActive++;
+        element(offset, g) = 0.0f;
+        element(fraction, g) = startFraction;
+        element(increment, g) = p.increment;
+        element(phase, g) = 0.0f;
+        element(phaseIncrement, g) = 1.0f / static_cast<float>(juce::jmax(1, length - 1));
+        remaining[static_cast<size_t>(g)] = length;
+
+        for (int chan = 0; chan < channels; chan++) {
+            float gain = p.gain;
+            if (channels == 2)
+                gain *= juce::jmin(1.0f, chan == 0 ? 1.0f - p.pan : 1.0f + p.pan);
+            element(gains[static_cast<size_t>(chan)], g) = gain;
+            source(g, chan) = p.source->getReadPointer(juce::jmin(chan, p.source->getNumChannels() - 1), static_cast<int>(start));
+        }
+        return true;
+    }
+
+    // Stops grain g (0 to getNumActive() - 1) at once. The last grain takes its place.
+    void retire(int g) {
+        jassert(g >= 0 && g < numActive);
+        const int last = --numActive;
+        if (g == last)
+            return;
+
+        for (auto* field : { &offset, &fraction, &increment, &phase, &phaseIncrement })
+            element(*field, g) = element(*field, last);
+        for (auto& gain : gains)
+            element(gain, g) = element(gain, last);
+        remaining[static_cast<size_t>(g)] = remaining[static_cast<size_t>(last)];
+        for (int chan = 0; chan < channels; chan++)
+            source(g, chan) = source(last, chan);
+    }
+
+    // Stops every grain at once.
+    void clear() { numActive = 0; }
+
+    // Samples grain g has left to play.
+    int getRemaining(int g) const { return remaining[static_cast<size_t>(g)]; }
+
+    // Adds the next numSamples of every grain into output from startSample, then retires the
+    // grains that have finished.
+    void render(juce::AudioBuffer<float>& output, int startSample, int numSamples) {
+        jassert(output.getNumChannels() >= channels);
+        juce::ScopedNoDenormals noDenormals;
+
+        for (int done = 0; done < numSamples; done += chunkSize) {
+            const int n = juce::jmin(chunkSize, numSamples - done);
+            renderChunk(output, startSample + done, n);
+
+            for (int g = numActive - 1; g >= 0; g--) {
+                remaining[static_cast<size_t>(g)] -= n;
+                if (remaining[static_cast<size_t>(g)] <= 0)
+                    retire(g);
+            }
+        }
+    }
+
+private:
+    static constexpr int chunkSize = 128;
+
+    static float& element(std::vector<Lanes>& field, int g) { return reinterpret_cast<float*>(field.data())[g]; }
+    const float*& source(int g, int chan) { return sources[static_cast<size_t>(g) * static_cast<size_t>(channels) + static_cast<size_t>(chan)]; }
+
+    // sin^2(pi p) for p in [0, 1]: cos(pi u / 2) with u = 2p - 1 as an even polynomial, its last
+    // term trimmed to put the ends exactly on zero (within 3e-5 of the true window).
+    static Lanes hann(Lanes p) {
+        const Lanes u = p + p - Lanes::expand(1.0f);
+        const Lanes t = u * u;
+        Lanes c = Lanes::expand(0.00089457f);
+        c = c * t + Lanes::expand(-0.02086348f);
+        c = c * t + Lanes::expand(0.25366951f);
+        c = c * t + Lanes::expand(-1.23370055f);
+        c = c * t + Lanes::expand(1.0f);
+        return c * c;
+    }
+
+    // Renders the grains a register at a time, in three passes over the chunk: the read positions
+    // are stepped across the register and stored; each lane's source samples are gathered in a
+    // scalar run along its grain (sequential reads, none waiting on a vector store); and the
+    // interpolation, envelope and gains run across the register again. Each register's output
+    // goes into vector accumulators, added across lanes once per output sample at the end.
+    void renderChunk(juce::AudioBuffer<float>& output, int startSample, int n) {
+        std::fill(accumulators.begin(), accumulators.end(), Lanes::expand(0.0f));
+
+        for (int first = 0; first < numActive; first += numLanes) {
+            const auto r = static_cast<size_t>(first / numLanes);
+            const int count = juce::jmin(numLanes, numActive - first);
+
+            // Read positions as whole samples plus a fraction, each taken from the chunk's start
+            // rather than stepped from the last, so no rounding carries from sample to sample
+            const Lanes off = offset[r], frac = fraction[r], inc = increment[r];
+            Lanes index = Lanes::expand(0.0f);
+            for (int i = 0; i < n; i++) {
+                const Lanes p = frac + index * inc;
+                const Lanes whole = Lanes::truncate(p);
+                positions[static_cast<size_t>(i)] = off + whole;
+                fractions[static_cast<size_t>(i)] = p - whole;
+                index += Lanes::expand(1.0f);
+            }
+            const Lanes end = frac + index * inc;
+            offset[r] = off + Lanes::truncate(end);
+            fraction[r] = end - Lanes::truncate(end);
+
+            // Each lane's grain, interpolated in a scalar run along it. Lanes without a grain, or
+            // past the end of theirs, are silent.
+            const float* position = reinterpret_cast<const float*>(positions.data());
+            const float* fractionAt = reinterpret_cast<const float*>(fractions.data());
+            for (int lane = 0; lane < numLanes; lane++) {
+                const int last = lane < count ? juce::jmin(n, remaining[static_cast<size_t>(first + lane)]) : 0;
+                const float* src[maxChannels] {};
+                float* x[maxChannels] {};
+                for (int chan = 0; chan < channels; chan++) {
+                    src[chan] = lane < count ? source(first + lane, chan) : nullptr;
+                    x[chan] = reinterpret_cast<float*>(samples.data() + chan * chunkSize) + lane;
+                }
+
+                if (channels == 2) {
+                    interpolate<2>(src, x, position + lane, fractionAt + lane, last, n);
+                }
+                else {
+                    for (int chan = 0; chan < channels; chan++)
+                        interpolate<1>(src + chan, x + chan, position + lane, fractionAt + lane, last, n);
+                }
+            }
+
+            Lanes ph = phase[r];
+            const Lanes phInc = phaseIncrement[r];
+            Lanes gain[maxChannels];
+            for (int chan = 0; chan < channels; chan++)
+                gain[chan] = gains[static_cast<size_t>(chan)][r];
+
+            for (int i = 0; i < n; i++) {
+                const Lanes envelope = hann(ph);
+                for (int chan = 0; chan < channels; chan++) {
+                    const auto k = static_cast<size_t>(chan * chunkSize + i);
+                    accumulators[k] += samples[k] * (envelope * gain[chan]);
+                }
+                ph += phInc;
+            }
+            phase[r] = ph;
+        }
+
+        for (int chan = 0; chan < channels; chan++) {
+            float* dest = output.getWritePointer(chan, startSample);
+            for (int i = 0; i < n; i++)
+                dest[i] += accumulators[static_cast<size_t>(chan * chunkSize + i)].sum();
+        }
+    }
+
+    // Writes one lane's interpolated source for NumChannels channels: samples [0, last) read
+    // from src at the lane's positions, the rest of the n are silent. Every array is strided by
+    // numLanes (the lane's column of a register array).
+    template <int NumChannels>
+    static void interpolate(const float* const* src, float* const* x, const float* position, const float* fractionAt,
+                            int last, int n) {
+        int i = 0;
+        for (; i < last; i++) {
+            const int k = static_cast<int>(position[i * numLanes]);
+            const float f = fractionAt[i * numLanes];
+            for (int chan = 0; chan < NumChannels; chan++) {
+                const float a = src[chan][k], b = src[chan][k + 1];
+                x[chan][i * numLanes] = a + f * (b - a);
+            }
+        }
+        for (; i < n; i++)
+            for (int chan = 0; chan < NumChannels; chan++)
+                x[chan][i * numLanes] = 0.0f;
+    }
+
+    int channels = 0, capacity = 0, numActive = 0;
+
+    // One element per grain, a register's worth of grains per Lanes. offset counts whole source
+    // samples from the grain's start (exact in float up to 2^24).
+    std::vector<Lanes> offset, fraction, increment, phase, phaseIncrement;
+    std::vector<std::vector<Lanes>> gains;
+    std::vector<int> remaining;
+    std::vector<const float*> sources;  // grain-major, a read pointer per output channel
+
+    // Per-chunk scratch: each sample's read position, and the interpolated source
+    std::vector<Lanes> accumulators, positions, fractions, samples;
+};
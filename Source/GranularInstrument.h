@@ -0,0 +1,246 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "GrainVoices.h"
+#include "ParallelRender.h"
+#include "SamplePool.h"
+#include "StreamingEnvelope.h"
+
+// A playable granular instrument: every MPE note is a cloud of grains read from one source at the
+// note's pitch. Per-note pitch bend retunes the grains it spawns, pressure thickens the cloud, and
+// timbre (CC74) moves where in the source the cloud reads.
+//
+// Notes never render audio themselves. They queue grains, and the grains of every note play from
+// one shared GrainVoiceStore, allocated in prepare(), so a block costs about the same however its
+// grains are split between notes. A grain plays out under its own envelope once spawned, so a
+// stolen or stopped note just stops spawning: its last grains ring out and nothing clicks.
+class GranularInstrument {
+public:
+    struct Parameters {
+        float grainLength = 0.08f;  // seconds
+        float density = 100.0f;     // grains per second per note, doubled at full pressure
+        float spread = 0.05f;       // seconds of random jitter in each grain's source position
+        float panSpread = 0.5f;     // random pan either side of centre
+        float rootNote = 60.0f;     // MIDI note the source plays at its own pitch
+        float gain = 0.1f;          // per grain, at full velocity
+        juce::ADSR::Parameters envelope { 0.02f, 0.1f, 0.8f, 0.3f };
+    };
+
+    // Grains are spawned on a grid this many samples apart, so the pool renders in runs at least
+    // this long whatever the density.
+    static constexpr int spawnResolution = 32;
+
+    // Caps that keep a 512-sample block at 48 kHz under 2 ms on one core: setParameters() limits
+    // the density to maxDensity, and by default no more than 384 grains sound at once. A grain
+    // spawned into a full pool is dropped, so a dense chord thins out rather than overrunning.
+    static constexpr float maxDensity = 200.0f;
+
+    GranularInstrument(int numVoices = 24, int maxGrains = 384) : capacity(maxGrains) {
+        juce::MPEZoneLayout layout;
+        layout.setLowerZone(15);
+        synth.setZoneLayout(layout);
+        synth.setVoiceStealingEnabled(true);
+        for (int i = 0; i < numVoices; i++)
+            synth.addVoice(new CloudVoice(*this, static_cast<juce::uint32>(i)));
+    }
+
+    // The source every note reads, loaded at sourceSampleRate (a SamplePool's engine rate). Not
+    // to be called while processBlock() runs; the grains of the last source are stopped.
+    void setSource(SamplePool::Entry::Ptr newSource, double sourceSampleRate) {
+        source = std::move(newSource);
+        sourceRate = sourceSampleRate;
+        grains.clear();
+    }
+
+    void setParameters(const Parameters& newParameters) {
+        parameters = newParameters;
+        parameters.density = juce::jmin(parameters.density, maxDensity);
+        for (int i = 0; i < synth.getNumVoices(); i++)
+            static_cast<CloudVoice*>(synth.getVoice(i))->envelope.setParameters(parameters.envelope);
+    }
+
+    const Parameters& getParameters() const { return parameters; }
+
+    // For the zone layout, legacy (non-MPE) mode, and the like.
+    juce::MPESynthesiser& getSynthesiser() { return synth; }
+
+    void prepare(double sampleRate, int maxBlockSize, int numOutputChannels) {
+        rate = sampleRate;
+        synth.setCurrentPlaybackSampleRate(sampleRate);
+        grains.prepare(numOutputChannels, capacity);
+        pending.clear();
+        pending.reserve(static_cast<size_t>(capacity));
+        for (int i = 0; i < synth.getNumVoices(); i++)
+            static_cast<CloudVoice*>(synth.getVoice(i))->prepare(sampleRate, maxBlockSize, parameters.envelope);
+        numDropped = 0;
+    }
+
+    // Plays the MIDI in midi and adds the block's grains into buffer.
+    void processBlock(juce::AudioBuffer<float>& buffer, const juce::MidiBuffer& midi) {
+        const int numSamples = buffer.getNumSamples();
+        pending.clear();
+        synth.renderNextBlock(buffer, midi, 0, numSamples);
+
+        // Each note queued its grains in time order; merge them, keeping notes' order on ties
+        std::sort(pending.begin(), pending.end(), [](const PendingGrain& a, const PendingGrain& b) {
+            return a.offset != b.offset ? a.offset < b.offset : a.order < b.order;
+        });
+
+        size_t next = 0;
+        for (int pos = 0; pos < numSamples;) {
+            for (; next < pending.size() && pending[next].offset <= pos; next++)
+                if (!grains.spawn(pending[next].grain))
+                    numDropped++;
+
+            int end = numSamples;
+            if (next < pending.size())
+                end = juce::jmin(numSamples, (pending[next].offset + spawnResolution - 1) / spawnResolution * spawnResolution);
+            grains.render(buffer, pos, end - pos);
+            pos = end;
+        }
+    }
+
+    // Spawns one grain outside any note, sounding from the next processBlock(): read from
+    // position (0 to 1 through the source) for lengthSeconds, pitched in semitones from the
+    // source's own. Call it from the thread that calls processBlock().
+    void triggerGrain(float position, float lengthSeconds, float pitchSemitones, float gain, float pan) {
+        if (source == nullptr || !source->isReady()) {
+            numDropped++;
+            return;
+        }
+        const auto& buffer = source->getBuffer();
+        GrainVoiceParameters grain;
+        grain.source = &buffer;
+        grain.length = juce::jmax(1, juce::roundToInt(lengthSeconds * rate));
+        grain.increment = static_cast<float>(std::exp2(pitchSemitones / 12.0) * sourceRate / rate);
+        const double room = juce::jmax(0.0, buffer.getNumSamples() - grain.length * static_cast<double>(grain.increment) - 4.0);
+        grain.sourcePosition = juce::jlimit(0.0f, 1.0f, position) * room;
+        grain.gain = gain;
+        grain.pan = juce::jlimit(-1.0f, 1.0f, pan);
+        if (!grains.spawn(grain))
+            numDropped++;
+    }
+
+    int getNumActiveGrains() const { return grains.getNumActive(); }
+
+    // Grains not played since prepare() because the pool (or the block's queue) was full.
+    juce::int64 getNumDroppedGrains() const { return numDropped; }
+
+private:
+    struct PendingGrain {
+        int offset;  // sample in the block
+        int order;
+        GrainVoiceParameters grain;
+    };
+
+    // One note's grain cloud. Its envelope sets the gain of each grain as it is spawned.
+    class CloudVoice : public juce::MPESynthesiserVoice {
+    public:
+        CloudVoice(GranularInstrument& owner, juce::uint32 index) : instrument(owner), random(getGrainRandom(index)) {}
+
+        void prepare(double sampleRate, int maxBlockSize, const juce::ADSR::Parameters& envelopeParameters) {
+            envelope.setSampleRate(sampleRate);
+            envelope.setParameters(envelopeParameters);
+            envelope.reset();
+            gain.assign(static_cast<size_t>(maxBlockSize), 0.0f);
+        }
+
+        void noteStarted() override {
+            // A stolen voice carries on from its current level and grain timing
+            if (!envelope.isActive())
+                untilNextGrain = 0.0;
+            envelope.noteOn();
+        }
+
+        void noteStopped(bool allowTailOff) override {
+            if (allowTailOff) {
+                envelope.noteOff();
+                return;
+            }
+            envelope.reset();
+            clearCurrentNote();
+        }
+
+        // Read as each grain is spawned
+        void notePressureChanged() override {}
+        void notePitchbendChanged() override {}
+        void noteTimbreChanged() override {}
+        void noteKeyStateChanged() override {}
+
+        void renderNextBlock(juce::AudioBuffer<float>&, int startSample, int numSamples) override {
+            const auto& p = instrument.parameters;
+            const auto* sourceEntry = instrument.source.get();
+            for (int done = 0; done < numSamples; done += static_cast<int>(gain.size())) {
+                const int n = juce::jmin(static_cast<int>(gain.size()), numSamples - done);
+                envelope.renderGain(gain.data(), n);
+                if (sourceEntry != nullptr && sourceEntry->isReady())
+                    queueGrains(sourceEntry->getBuffer(), p, startSample + done, n);
+            }
+            if (!envelope.isActive())
+                clearCurrentNote();
+        }
+
+        StreamingADSR envelope;
+
+    private:
+        // Queues this note's grains that start within the n samples from start.
+        void queueGrains(const juce::AudioBuffer<float>& source, const Parameters& p, int start, int n) {
+            const auto note = getCurrentlyPlayingNote();
+            const double outputRate = instrument.rate;
+            const int length = juce::jmax(1, juce::roundToInt(p.grainLength * outputRate));
+            const double interval = outputRate / (p.density * (1.0f + note.pressure.asUnsignedFloat()));
+
+            // Source samples per output sample: the note's pitch, bend included, against the root
+            const double rootHz = 440.0 * std::exp2((p.rootNote - 69.0) / 12.0);
+            const auto ratio = static_cast<float>(note.getFrequencyInHertz() / rootHz * instrument.sourceRate / outputRate);
+            const double span = static_cast<double>(length) * ratio;
+            const double room = juce::jmax(0.0, source.getNumSamples() - span - 4.0);
+            const float velocity = note.noteOnVelocity.asUnsignedFloat();
+
+            for (; untilNextGrain < n; untilNextGrain += interval * (0.5 + random.nextDouble())) {
+                const int offset = static_cast<int>(untilNextGrain);
+                const float level = gain[static_cast<size_t>(offset)];
+                if (level <= 0.0f)
+                    continue;
+
+                GrainVoiceParameters grain;
+                grain.source = &source;
+                grain.sourcePosition = juce::jlimit(0.0, room, note.timbre.asUnsignedFloat() * room
+                                                                   + (random.nextDouble() * 2.0 - 1.0) * p.spread * instrument.sourceRate);
+                grain.length = length;
+                grain.increment = ratio;
+                grain.gain = p.gain * velocity * level;
+                grain.pan = (random.nextFloat() * 2.0f - 1.0f) * p.panSpread;
+                instrument.queue(start + offset, grain);
+            }
+            untilNextGrain -= n;
+        }
+
+        GranularInstrument& instrument;
+        juce::Random random;
+        std::vector<float> gain;
+        double untilNextGrain = 0.0;
+    };
+
+    void queue(int offset, const GrainVoiceParameters& grain) {
+        // Never grows on the audio thread: a full queue drops the grain like a full pool
+        if (pending.size() == pending.capacity()) {
+            numDropped++;
+            return;
+        }
+        pending.push_back({ offset, static_cast<int>(pending.size()), grain });
+    }
+
+    juce::MPESynthesiser synth;
+    Parameters parameters;
+    SamplePool::Entry::Ptr source;
+    double sourceRate = 48000.0, rate = 48000.0;
+
+    int capacity;
+    GrainVoiceStore grains;
+    std::vector<PendingGrain> pending;
+    juce::int64 numDropped = 0;
+};
@@ -0,0 +1,147 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <ctime>
+#include <JuceHeader.h>
+#include "GranularInstrument.h"
+#include "LoudnessMeter.h"
+
+// CPU time this thread has used, in ms. Unlike the wall clock it leaves out time the OS gave to
+// other processes, which on a busy machine can be longer than the whole budget.
+static double threadCpuMs() {
+    timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return static_cast<double>(t.tv_sec) * 1000.0 + static_cast<double>(t.tv_nsec) / 1.0e6;
+}
+
+// Plays the granular instrument offline, a block at a time as a host would, and reports how long
+// each block took against the real-time budget, failing if any went over. Two 16-note chords
+// overlap, so the second steals voices from the first as it rings out; every note gets its own
+// drifting pitch bend, pressure and timbre, on its own MIDI channel.
+int main(int argc, char* argv[]) {
+    std::string inputwav  = "/Users/apple/Desktop/Spring25/granBasics/input.wav";
+    std::string outputwav = "/Users/apple/Desktop/Spring25/granBasics/instrument.wav";
+    double durationSec = 10.0;
+    float density = 200.0f;  // grains per second per note
+
+    if (argc > 1) inputwav = argv[1];
+    if (argc > 2) outputwav = argv[2];
+    if (argc > 3) durationSec = std::atof(argv[3]);
+    if (argc > 4) density = static_cast<float>(std::atof(argv[4]));
+
+    auto cwd = juce::File::getCurrentWorkingDirectory();
+    juce::File inputfile = cwd.getChildFile(inputwav);
+    juce::File outputfile = cwd.getChildFile(outputwav);
+
+    const double samplerate = 48000.0;
+    const int blockSize = 512;
+    const int numchannels = 2;
+    const double budgetMs = 2.0;
+
+    SamplePool samplePool(samplerate, 512 * 1024 * 1024);
+    auto source = samplePool.load(inputfile);
+    if (!source->isReady()) {
+        std::cout << "Failed to open input file." << std::endl;
+        return 1;
+    }
+
+    GranularInstrument instrument;
+    GranularInstrument::Parameters parameters;
+    parameters.density = density;
+    instrument.setParameters(parameters);
+    if (instrument.getParameters().density < density)
+        std::cout << "Density limited to " << instrument.getParameters().density << " grains per second per note." << std::endl;
+    instrument.setSource(source, samplerate);
+
+    // One note per channel, so each has its own bend, pressure and timbre without an MPE controller
+    instrument.getSynthesiser().enableLegacyMode(2, juce::Range<int>(1, 17));
+    instrument.prepare(samplerate, blockSize, numchannels);
+
+    outputfile.deleteFile();
+    std::unique_ptr<juce::FileOutputStream> fileStream(outputfile.createOutputStream());
+    if (!fileStream) {
+        std::cout << "Failed to create output stream." << std::endl;
+        return 1;
+    }
+
+    juce::AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+    std::unique_ptr<juce::AudioFormatWriter> writer(
+        formatManager.findFormatForFileExtension("wav")->createWriterFor(
+            fileStream.get(),
+            samplerate,
+            static_cast<unsigned int>(numchannels),
+            16,
+            {},
+            0));
+
+    if (!writer) {
+        std::cout << "Failed to create writer." << std::endl;
+        return 1;
+    }
+    fileStream.release();
+
+    // The second chord starts a third of the way in and the first is released at the same time;
+    // both are released a second before the end
+    const int chordSize = 16;
+    const juce::int64 totalSamples = static_cast<juce::int64>(durationSec * samplerate);
+    const juce::int64 secondChord = totalSamples / 3;
+    const juce::int64 release = totalSamples - static_cast<juce::int64>(samplerate);
+    auto notesOf = [](int chord, int k) { return 36 + (chord == 0 ? 0 : 5) + k * 3; };
+
+    juce::AudioBuffer<float> block(numchannels, blockSize);
+    juce::MidiBuffer midi;
+    LoudnessMeter loudness;
+    loudness.prepare(samplerate, numchannels);
+
+    std::vector<double> blockMs;
+    int maxGrains = 0;
+    for (juce::int64 pos = 0; pos < totalSamples; pos += blockSize) {
+        const int n = static_cast<int>(std::min<juce::int64>(blockSize, totalSamples - pos));
+        midi.clear();
+        auto inBlock = [&](juce::int64 t) { return t >= pos && t < pos + n; };
+        for (int k = 0; k < chordSize; k++) {
+            const int channel = k + 1;
+            if (inBlock(0))
+                midi.addEvent(juce::MidiMessage::noteOn(channel, notesOf(0, k), 0.8f), 0);
+            if (inBlock(secondChord)) {
+                midi.addEvent(juce::MidiMessage::noteOff(channel, notesOf(0, k)), static_cast<int>(secondChord - pos));
+                midi.addEvent(juce::MidiMessage::noteOn(channel, notesOf(1, k), 0.8f), static_cast<int>(secondChord - pos));
+            }
+            if (inBlock(release))
+                midi.addEvent(juce::MidiMessage::noteOff(channel, notesOf(1, k)), static_cast<int>(release - pos));
+
+            // Expression, once a block: a slow vibrato, swelling pressure, a timbre sweep
+            const double t = static_cast<double>(pos) / samplerate;
+            const double wobble = std::sin(juce::MathConstants<double>::twoPi * (0.3 + 0.05 * k) * t);
+            midi.addEvent(juce::MidiMessage::pitchWheel(channel, juce::jlimit(0, 16383, 8192 + static_cast<int>(2000.0 * wobble))), 0);
+            midi.addEvent(juce::MidiMessage::channelPressureChange(channel, juce::jlimit(0, 127, static_cast<int>(64.0 + 63.0 * wobble))), 0);
+            midi.addEvent(juce::MidiMessage::controllerEvent(channel, 74, static_cast<int>(127.0 * (0.5 + 0.5 * std::sin(t * 0.2 + k)))), 0);
+        }
+
+        block.setSize(numchannels, n, false, false, true);
+        block.clear();
+        const auto start = threadCpuMs();
+        instrument.processBlock(block, midi);
+        blockMs.push_back(threadCpuMs() - start);
+        maxGrains = std::max(maxGrains, instrument.getNumActiveGrains());
+
+        writer->writeFromAudioSampleBuffer(block, 0, n);
+        loudness.process(block, 0, n);
+    }
+    writer.reset();
+
+    std::vector<double> sorted(blockMs);
+    std::sort(sorted.begin(), sorted.end());
+    const auto overBudget = std::count_if(blockMs.begin(), blockMs.end(), [&](double ms) { return ms > budgetMs; });
+    double total = 0.0;
+    for (auto ms : blockMs)
+        total += ms;
+
+    std::cout << "Instrument render complete: " << blockMs.size() << " blocks of " << blockSize << ", CPU time mean "
+              << total / static_cast<double>(blockMs.size()) << " ms, 99th percentile " << sorted[sorted.size() * 99 / 100]
+              << " ms, worst " << sorted.back() << " ms, " << overBudget << " over the " << budgetMs << " ms budget." << std::endl;
+    std::cout << "Up to " << maxGrains << " grains at once, " << instrument.getNumDroppedGrains() << " dropped." << std::endl;
+    std::cout << "Loudness: " << loudness.getSummary() << "." << std::endl;
+    return overBudget > 0 ? 1 : 0;
+}
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Finds the true (inter-sample) peak of each input sample: the largest magnitude across all
+// channels of the sample itself and the three points a 4x oversampled signal has between it and
+// the next. The in-between points come from 12-tap Kaiser-windowed sinc interpolators, one per
+// phase: linear phase, so the waveform's shape (and so its peaks) survive, and cheap enough to
+// run as vector multiply-adds over a block. Only the last few input samples are kept between blocks.
+class TruePeakDetector {
+public:
+    void prepare(int numChannels, int maxBlockSize) {
+        channels = numChannels;
+        blockSize = maxBlockSize;
+
+        for (int phase = 0; phase < numPhases; phase++) {
+            const double fraction = (phase + 1) / 4.0;
+            double sum = 0.0;
+            for (int k = 0; k < numTaps; k++) {
+                const double t = k - (numTaps / 2 - 1) - fraction;  // distance from the point
+                const double x = t / (numTaps / 2);
+                const double window = besselI0(kaiserBeta * std::sqrt(juce::jmax(0.0, 1.0 - x * x))) / besselI0(kaiserBeta);
+                const double sinc = std::sin(juce::MathConstants<double>::pi * t) / (juce::MathConstants<double>::pi * t);
+                coefficients[phase][k] = sinc * window;
+                sum += coefficients[phase][k];
+            }
+            for (auto& c : coefficients[phase])
+                c /= sum;
+        }
+
+        history.setSize(numChannels, numTaps - 1 + maxBlockSize);
+        interpolated.resize(static_cast<size_t>(maxBlockSize));
+        reset();
+    }
+
+    void reset() { history.clear(); }
+
+    // How many samples after an input sample its peak is reported.
+    int getLatency() const { return numTaps / 2; }
+
+    int getMaxBlockSize() const { return blockSize; }
+
+    // Writes the true peak of each of numSamples (at most getMaxBlockSize()) samples into peaks.
+    void process(const juce::AudioBuffer<float>& buffer, int startSample, int numSamples, float* peaks) {
+        jassert(numSamples <= blockSize);
+        const int kept = numTaps - 1;
+        float* point = interpolated.data();
+
+        juce::FloatVectorOperations::clear(peaks, numSamples);
+        for (int chan = 0; chan < channels; chan++) {
+            // The input as one run: the last kept samples, then this block.
+            float* data = history.getWritePointer(chan);
+            juce::FloatVectorOperations::copy(data + kept, buffer.getReadPointer(chan, startSample), numSamples);
+
+            // peaks[i] covers input sample i - getLatency(), which is data[i + kept - getLatency()].
+            juce::FloatVectorOperations::abs(point, data + kept - getLatency(), numSamples);
+            juce::FloatVectorOperations::max(peaks, peaks, point, numSamples);
+
+            for (const auto& phase : coefficients) {
+                juce::FloatVectorOperations::clear(point, numSamples);
+                for (int k = 0; k < numTaps; k++)
+                    juce::FloatVectorOperations::addWithMultiply(point, data + k, static_cast<float>(phase[k]), numSamples);
+                juce::FloatVectorOperations::abs(point, point, numSamples);
+                juce::FloatVectorOperations::max(peaks, peaks, point, numSamples);
+            }
+
+            std::copy(data + numSamples, data + numSamples + kept, data);
+        }
+    }
+
+private:
+    static constexpr int numTaps = 12;
+    static constexpr int numPhases = 3;
+    static constexpr double kaiserBeta = 5.0;
+
+    static double besselI0(double x) {
+        double sum = 1.0, term = 1.0;
+        for (int k = 1; k < 32; k++) {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    double coefficients[numPhases][numTaps] {};
+    juce::AudioBuffer<float> history;
+    std::vector<float> interpolated;
+    int channels = 0, blockSize = 0;
+};
+
+// A streaming lookahead limiter that keeps the true peak of its output under a ceiling.
+//
+// The gain each sample needs is fed through a sliding minimum over the lookahead window, held
+// with an exponential release, and smoothed by a moving average over the same window, so the
+// gain has fully come down by the time the peak that needed it comes out of the delay. Every
+// stage is a fixed-size ring, so memory is bounded by the lookahead whatever the block size.
+//
+// Output is delayed by getLatencySamples().
+class LookaheadLimiter {
+public:
+    void prepare(double sampleRate, int numChannels, int maxBlockSize, float ceilingDb = -1.0f,
+                 double lookaheadMs = 2.0, double releaseMs = 80.0) {
+        channels = numChannels;
+        ceiling = juce::Decibels::decibelsToGain(ceilingDb);
+        window = juce::jmax(1, juce::roundToInt(sampleRate * lookaheadMs * 0.001));
+        releaseCoeff = static_cast<float>(std::exp(-1.0 / juce::jmax(1.0, sampleRate * releaseMs * 0.001)));
+
+        detector.prepare(numChannels, maxBlockSize);
+        latency = window - 1 + detector.getLatency();
+
+        peaks.resize(static_cast<size_t>(maxBlockSize));
+        gains.resize(static_cast<size_t>(maxBlockSize));
+        minValues.resize(static_cast<size_t>(window));
+        minIndices.resize(static_cast<size_t>(window));
+        averageRing.resize(static_cast<size_t>(window));
+        delayLines.assign(static_cast<size_t>(numChannels), std::vector<float>(static_cast<size_t>(latency + 1)));
+        reset();
+    }
+
+    void reset() {
+        detector.reset();
+        minHead = minCount = 0;
+        sampleIndex = 0;
+        held = 1.0f;
+        std::fill(averageRing.begin(), averageRing.end(), 1.0f);
+        averageSum = static_cast<double>(window);
+        averagePos = 0;
+        for (auto& line : delayLines)
+            std::fill(line.begin(), line.end(), 0.0f);
+        delayPos = 0;
+        lowestGain = 1.0f;
+    }
+
+    int getLatencySamples() const { return latency; }
+
+    // The deepest gain reduction applied since the last reset, as a gain.
+    float getLowestGain() const { return lowestGain; }
+
+    // Limits numSamples of buffer in place (the result lags the input by getLatencySamples()).
+    void process(juce::AudioBuffer<float>& buffer, int startSample, int numSamples) {
+        const int blockSize = detector.getMaxBlockSize();
+        for (int done = 0; done < numSamples; done += blockSize) {
+            const int n = juce::jmin(blockSize, numSamples - done);
+            detector.process(buffer, startSample + done, n, peaks.data());
+            computeGains(n);
+            applyGains(buffer, startSample + done, n);
+        }
+    }
+
+private:
+    void computeGains(int numSamples) {
+        for (int i = 0; i < numSamples; i++, sampleIndex++) {
+            const float needed = peaks[static_cast<size_t>(i)] > ceiling ? ceiling / peaks[static_cast<size_t>(i)] : 1.0f;
+
+            // Sliding minimum over the last `window` samples: a ring of increasing gains whose
+            // front is the minimum, dropping entries that leave the window or can no longer win.
+            if (minCount > 0 && minIndices[static_cast<size_t>(minHead)] <= sampleIndex - window) {
+                minHead = (minHead + 1) % window;
+                minCount--;
+            }
+            while (minCount > 0 && minValues[ringIndex(minCount - 1)] >= needed)
+                minCount--;
+            minValues[ringIndex(minCount)] = needed;
+            minIndices[ringIndex(minCount)] = sampleIndex;
+            minCount++;
+            const float windowMin = minValues[static_cast<size_t>(minHead)];
+
+            held = juce::jmin(windowMin, held * releaseCoeff + (1.0f - releaseCoeff));
+
+            averageSum += static_cast<double>(held) - averageRing[static_cast<size_t>(averagePos)];
+            averageRing[static_cast<size_t>(averagePos)] = held;
+            averagePos = (averagePos + 1) % window;
+
+            const auto gain = static_cast<float>(averageSum / window);
+            gains[static_cast<size_t>(i)] = gain;
+            lowestGain = juce::jmin(lowestGain, gain);
+        }
+    }
+
+    void applyGains(juce::AudioBuffer<float>& buffer, int startSample, int numSamples) {
+        const int length = latency + 1;
+        for (int chan = 0; chan < channels; chan++) {
+            float* data = buffer.getWritePointer(chan, startSample);
+            float* line = delayLines[static_cast<size_t>(chan)].data();
+            int pos = delayPos;
+            for (int i = 0; i < numSamples; i++) {
+                line[pos] = data[i];
+                pos = pos + 1 == length ? 0 : pos + 1;
+                data[i] = line[pos] * gains[static_cast<size_t>(i)];
+            }
+        }
+        delayPos = (delayPos + numSamples) % length;
+    }
+
+    size_t ringIndex(int offset) const { return static_cast<size_t>((minHead + offset) % window); }
+
+    TruePeakDetector detector;
+    int channels = 0, window = 1, latency = 0;
+    float ceiling = 1.0f, releaseCoeff = 0.0f;
+
+    std::vector<float> peaks, gains;
+
+    std::vector<float> minValues;
+    std::vector<juce::int64> minIndices;
+    int minHead = 0, minCount = 0;
+    juce::int64 sampleIndex = 0;
+
+    float held = 1.0f;
+    std::vector<float> averageRing;
+    double averageSum = 0.0;
+    int averagePos = 0;
+
+    std::vector<std::vector<float>> delayLines;
+    int delayPos = 0;
+    float lowestGain = 1.0f;
+};
+
+// Two-pass peak normalisation: measure() every block of a render, finishMeasuring(), then
+// apply() getGain() to the same blocks. Only the detector's filter state is kept between blocks.
+class PeakNormalizer {
+public:
+    void prepare(int numChannels, int maxBlockSize) {
+        detector.prepare(numChannels, maxBlockSize);
+        peaks.resize(static_cast<size_t>(maxBlockSize));
+        flush.setSize(numChannels, juce::jmin(maxBlockSize, detector.getLatency() + 4));
+        flush.clear();
+        peak = 0.0f;
+    }
+
+    void measure(const juce::AudioBuffer<float>& buffer, int startSample, int numSamples) {
+        const int blockSize = detector.getMaxBlockSize();
+        for (int done = 0; done < numSamples; done += blockSize) {
+            const int n = juce::jmin(blockSize, numSamples - done);
+            detector.process(buffer, startSample + done, n, peaks.data());
+            peak = juce::jmax(peak, juce::FloatVectorOperations::findMaximum(peaks.data(), n));
+        }
+    }
+
+    // Runs silence through the detector so the last samples' peaks come out of its filters.
+    void finishMeasuring() { measure(flush, 0, flush.getNumSamples()); }
+
+    float getPeak() const { return peak; }
+
+    // The gain that brings the measured true peak to targetDb (1 for silence).
+    float getGain(float targetDb) const {
+        return peak > 0.0f ? juce::Decibels::decibelsToGain(targetDb) / peak : 1.0f;
+    }
+
+    void apply(juce::AudioBuffer<float>& buffer, int startSample, int numSamples, float gain) const {
+        buffer.applyGain(startSample, numSamples, gain);
+    }
+
+private:
+    TruePeakDetector detector;
+    std::vector<float> peaks;
+    juce::AudioBuffer<float> flush;
+    float peak = 0.0f;
+};
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// EBU R128 / ITU-R BS.1770-4 loudness, measured as audio streams past: integrated loudness,
+// momentary (400 ms) and short-term (3 s) loudness, and loudness range (EBU Tech 3342).
+//
+// Each channel is K-weighted by the two BS.1770 biquads, run in double with several channels side
+// by side in one SIMDRegister. Weighted energy is summed per 100 ms step; the last 30 steps give the
+// momentary and short-term windows, and every gating block's loudness goes into a 0.01 LU
+// histogram, so the gated results come without keeping the blocks or making a second pass.
+class LoudnessMeter {
+public:
+    void prepare(double sampleRate, int numChannels) {
+        channels = numChannels;
+        hop = juce::jmax(1, juce::roundToInt(sampleRate * 0.1));
+
+        // BS.1770 weights: L, R, C at 1, LFE ignored, surrounds at +1.5 dB (for 5.1 in the usual
+        // L R C LFE Ls Rs order).
+        weights.assign(static_cast<size_t>(numChannels), 1.0);
+        if (numChannels == 6) {
+            weights[3] = 0.0;
+            weights[4] = weights[5] = 1.41;
+        }
+
+        // The pre-filter (high shelf) and RLB high-pass, from their analog prototypes so that any
+        // sample rate gets the curve the standard tabulates for 48 kHz.
+        {
+            const double k = std::tan(juce::MathConstants<double>::pi * 1681.974450955533 / sampleRate);
+            const double q = 0.7071752369554196;
+            const double vh = std::pow(10.0, 3.999843853973347 / 20.0);
+            const double vb = std::pow(vh, 0.4996667741545416);
+            const double a0 = 1.0 + k / q + k * k;
+            stages[0] = makeStage((vh + vb * k / q + k * k) / a0, 2.0 * (k * k - vh) / a0, (vh - vb * k / q + k * k) / a0,
+                                  2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0);
+        }
+        {
+            const double k = std::tan(juce::MathConstants<double>::pi * 38.13547087602444 / sampleRate);
+            const double q = 0.5003270373238773;
+            const double a0 = 1.0 + k / q + k * k;
+            stages[1] = makeStage(1.0, -2.0, 1.0, 2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0);
+        }
+
+        numGroups = (numChannels + static_cast<int>(lanes) - 1) / static_cast<int>(lanes);
+        state.assign(static_cast<size_t>(numGroups), {});
+        channelEnergy.assign(static_cast<size_t>(numGroups) * lanes, 0.0);
+        reset();
+    }
+
+    void reset() {
+        for (auto& s : state)
+            s = {};
+        std::fill(channelEnergy.begin(), channelEnergy.end(), 0.0);
+        std::fill(std::begin(steps), std::end(steps), 0.0);
+        stepPosition = 0;
+        numSteps = 0;
+        blocks.clear();
+        shortTerm.clear();
+        momentaryMax = shortTermMax = -std::numeric_limits<double>::infinity();
+    }
+
+    void process(const juce::AudioBuffer<float>& buffer, int startSample, int numSamples) {
+        juce::ScopedNoDenormals noDenormals;
+        while (numSamples > 0) {
+            const int n = juce::jmin(numSamples, hop - stepPosition);
+            for (int group = 0; group < numGroups; group++)
+                filterGroup(buffer, group, startSample, n);
+
+            startSample += n;
+            numSamples -= n;
+            stepPosition += n;
+            if (stepPosition == hop)
+                finishStep();
+        }
+    }
+
+    // Gated loudness of everything so far, in LUFS (-inf until a block passes the -70 LUFS gate).
+    double getIntegratedLoudness() const { return blocks.getGatedLoudness(-10.0); }
+
+    // Spread of the short-term loudness, 10th to 95th percentile above its relative gate, in LU.
+    double getLoudnessRange() const {
+        const double gate = shortTerm.getUngatedLoudness() - 20.0;
+        return shortTerm.getPercentile(0.95, gate) - shortTerm.getPercentile(0.10, gate);
+    }
+
+    double getMomentaryLoudness() const { return numSteps >= 4 ? toLoudness(windowEnergy(4)) : minusInfinity(); }
+    double getShortTermLoudness() const { return numSteps >= 30 ? toLoudness(windowEnergy(30)) : minusInfinity(); }
+    double getMaxMomentaryLoudness() const { return momentaryMax; }
+    double getMaxShortTermLoudness() const { return shortTermMax; }
+
+    // The gain that would bring the integrated loudness to targetLufs (1 if nothing was measured).
+    float getGainToTarget(double targetLufs) const {
+        const double integrated = getIntegratedLoudness();
+        return std::isfinite(integrated) ? static_cast<float>(juce::Decibels::decibelsToGain(targetLufs - integrated, -1000.0)) : 1.0f;
+    }
+
+    // One line of results for a job's stats output. gainDb gives the results for the same audio
+    // scaled by that gain, without metering it again: every loudness moves by gainDb and the range
+    // stays put (blocks crossing the -70 LUFS absolute gate aside).
+    juce::String getSummary(double gainDb = 0.0) const {
+        auto format = [](double value, const char* unit) {
+            return std::isfinite(value) ? juce::String(value, 1) + " " + unit : juce::String("-inf ") + unit;
+        };
+        return format(getIntegratedLoudness() + gainDb, "LUFS") + " integrated, " + format(getLoudnessRange(), "LU")
+               + " range, max short-term " + format(shortTermMax + gainDb, "LUFS") + ", max momentary "
+               + format(momentaryMax + gainDb, "LUFS");
+    }
+
+private:
+    using Lanes = juce::dsp::SIMDRegister<double>;
+    static constexpr size_t lanes = Lanes::SIMDNumElements;
+
+    struct Stage {
+        Lanes b0, b1, b2, a1, a2;
+    };
+
+    struct GroupState {
+        Lanes s1[2] {}, s2[2] {};
+    };
+
+    // Loudness values in 0.01 LU bins from -70 LUFS (the absolute gate) up, each bin holding how
+    // many values fell in it and their summed energy.
+    class Histogram {
+    public:
+        Histogram() : counts(numBins), energies(numBins) {}
+
+        void clear() {
+            std::fill(counts.begin(), counts.end(), 0);
+            std::fill(energies.begin(), energies.end(), 0.0);
+        }
+
+        void add(double energy) {
+            const double loudness = toLoudness(energy);
+            if (!(loudness >= absoluteGate))
+                return;
+            const auto bin = juce::jmin(numBins - 1, static_cast<int>((loudness - absoluteGate) / binWidth));
+            counts[static_cast<size_t>(bin)]++;
+            energies[static_cast<size_t>(bin)] += energy;
+        }
+
+        double getUngatedLoudness() const { return getGatedLoudness(-std::numeric_limits<double>::infinity()); }
+
+        // Mean loudness of the values within relativeGate LU of the ungated mean (BS.1770's
+        // two-stage gate when relativeGate is -10).
+        double getGatedLoudness(double relativeGate) const {
+            double threshold = absoluteGate;
+            if (std::isfinite(relativeGate)) {
+                const double ungated = getUngatedLoudness();
+                if (!std::isfinite(ungated))
+                    return ungated;
+                threshold = juce::jmax(absoluteGate, ungated + relativeGate);
+            }
+
+            juce::uint64 count = 0;
+            double energy = 0.0;
+            for (int bin = firstBinFrom(threshold); bin < numBins; bin++) {
+                count += counts[static_cast<size_t>(bin)];
+                energy += energies[static_cast<size_t>(bin)];
+            }
+            return count > 0 ? toLoudness(energy / static_cast<double>(count)) : minusInfinity();
+        }
+
+        // The loudness below which the given fraction of the values at or above threshold fall.
+        double getPercentile(double fraction, double threshold) const {
+            const int first = firstBinFrom(threshold);
+            juce::uint64 total = 0;
+            for (int bin = first; bin < numBins; bin++)
+                total += counts[static_cast<size_t>(bin)];
+            if (total == 0)
+                return 0.0;
+
+            const auto target = static_cast<juce::uint64>(fraction * static_cast<double>(total - 1));
+            juce::uint64 seen = 0;
+            for (int bin = first; bin < numBins; bin++) {
+                seen += counts[static_cast<size_t>(bin)];
+                if (seen > target)
+                    return absoluteGate + (bin + 0.5) * binWidth;
+            }
+            return absoluteGate + numBins * binWidth;
+        }
+
+    private:
+        static constexpr double absoluteGate = -70.0;
+        static constexpr double binWidth = 0.01;
+        static constexpr int numBins = 10000;  // up to +30 LUFS
+
+        static int firstBinFrom(double loudness) {
+            if (!std::isfinite(loudness))
+                return 0;
+            return juce::jlimit(0, numBins, static_cast<int>(std::ceil((loudness - absoluteGate) / binWidth - 0.5)));
+        }
+
+        std::vector<juce::uint64> counts;
+        std::vector<double> energies;
+    };
+
+    static Stage makeStage(double b0, double b1, double b2, double a1, double a2) {
+        return { Lanes::expand(b0), Lanes::expand(b1), Lanes::expand(b2), Lanes::expand(a1), Lanes::expand(a2) };
+    }
+
+    static double minusInfinity() { return -std::numeric_limits<double>::infinity(); }
+
+    static double toLoudness(double energy) {
+        return energy > 0.0 ? -0.691 + 10.0 * std::log10(energy) : minusInfinity();
+    }
+
+    // K-weights one group of channels for n samples and adds their squares to each channel's
+    // energy for the current step.
+    void filterGroup(const juce::AudioBuffer<float>& buffer, int group, int startSample, int n) {
+        const float* input[lanes] {};
+        for (size_t lane = 0; lane < lanes; lane++) {
+            const int chan = group * static_cast<int>(lanes) + static_cast<int>(lane);
+            input[lane] = chan < channels ? buffer.getReadPointer(chan, startSample) : nullptr;
+        }
+
+        auto& s = state[static_cast<size_t>(group)];
+        Lanes energy = Lanes::expand(0.0);
+        alignas(Lanes::SIMDRegisterSize) double frame[lanes] {};
+
+        for (int i = 0; i < n; i++) {
+            for (size_t lane = 0; lane < lanes; lane++)
+                frame[lane] = input[lane] != nullptr ? static_cast<double>(input[lane][i]) : 0.0;
+            Lanes x = Lanes::fromRawArray(frame);
+
+            // Transposed direct form II, both stages.
+            for (int stage = 0; stage < 2; stage++) {
+                const auto& c = stages[stage];
+                const Lanes y = c.b0 * x + s.s1[stage];
+                s.s1[stage] = c.b1 * x - c.a1 * y + s.s2[stage];
+                s.s2[stage] = c.b2 * x - c.a2 * y;
+                x = y;
+            }
+            energy += x * x;
+        }
+
+        energy.copyToRawArray(frame);
+        for (size_t lane = 0; lane < lanes; lane++)
+            channelEnergy[static_cast<size_t>(group) * lanes + lane] += frame[lane];
+    }
+
+    void finishStep() {
+        double weighted = 0.0;
+        for (int chan = 0; chan < channels; chan++)
+            weighted += weights[static_cast<size_t>(chan)] * channelEnergy[static_cast<size_t>(chan)];
+        std::fill(channelEnergy.begin(), channelEnergy.end(), 0.0);
+
+        steps[numSteps % maxSteps] = weighted;
+        numSteps++;
+        stepPosition = 0;
+
+        // A 400 ms gating block ends every 100 ms, and a 3 s short-term window once there's 3 s.
+        if (numSteps >= 4) {
+            const double block = windowEnergy(4);
+            blocks.add(block);
+            momentaryMax = juce::jmax(momentaryMax, toLoudness(block));
+        }
+        if (numSteps >= maxSteps) {
+            const double window = windowEnergy(maxSteps);
+            shortTerm.add(window);
+            shortTermMax = juce::jmax(shortTermMax, toLoudness(window));
+        }
+    }
+
+    // Mean weighted energy over the last numWindowSteps steps.
+    double windowEnergy(int numWindowSteps) const {
+        double sum = 0.0;
+        for (int i = 1; i <= numWindowSteps; i++)
+            sum += steps[(numSteps - i) % maxSteps];
+        return sum / (static_cast<double>(numWindowSteps) * hop);
+    }
+
+    static constexpr int maxSteps = 30;
+
+    int channels = 0, hop = 4800, numGroups = 0;
+    std::vector<double> weights;
+    Stage stages[2];
+    std::vector<GroupState> state;
+    std::vector<double> channelEnergy;
+
+    double steps[maxSteps] {};
+    int stepPosition = 0;
+    juce::int64 numSteps = 0;
+
+    Histogram blocks, shortTerm;
+    double momentaryMax = 0.0, shortTermMax = 0.0;
+};
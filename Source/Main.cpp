@@ -2,91 +2,134 @@
 #include <vector>
 #include <algorithm>
 #include <JuceHeader.h>
+#include "SourceAnalysis.h"
+#include "SpectralEngine.h"
+#include "GrainRenderer.h"
+#include "GrainFilter.h"
+#include "GrainMap.h"
+#include "PeakPyramid.h"
+#include "Trace.h"
+#include "SamplePool.h"
+#include "GrainLog.h"
+#include "ParallelRender.h"
+#include "Limiter.h"
+#include "LoudnessMeter.h"
+#include "Convolution.h"
+#include "ModulationMatrix.h"
 
 // Convert time (in seconds) to samples
 float timetosamples(float time, int samplerate) {
     return time * samplerate;
 }
 
-// Circular buffer (delay line) class
-class Circularbuff {
+// The grains as a delay line sees them: every grain's in-range samples pushed through it one
+// after another, so output sample pos of grain i reads the stream delaySamples before the sample
+// that grain i pushed there. Any stretch of output can be mixed from this on its own, in any
+// order, which is what lets the mix run in parallel.
+class DelayedGrainStream {
 public:
-    Circularbuff(int size) : buffer(size, 0.0f), writepos(0), buffersize(size) {}
+    DelayedGrainStream(std::vector<const juce::AudioBuffer<float>*> grainBuffers, std::vector<juce::int64> grainStarts,
+                       juce::int64 outputLength, int delay)
+        : buffers(std::move(grainBuffers)), starts(std::move(grainStarts)), delaySamples(std::max(0, delay)) {
+        offsets.push_back(0);
+        for (size_t i = 0; i < buffers.size(); i++) {
+            auto used = std::clamp<juce::int64>(outputLength - starts[i], 0, buffers[i]->getNumSamples());
+            lengths.push_back(used);
+            offsets.push_back(offsets.back() + used);
+        }
+    }
+
+    size_t getNumGrains() const { return buffers.size(); }
+    juce::int64 getStart(size_t grain) const { return starts[grain]; }
+    juce::int64 getEnd(size_t grain) const { return starts[grain] + lengths[grain]; }
+
+    // Adds grain's delayed output for output samples [from, to) into dest, which holds the output
+    // from destStart on.
+    void mixGrain(size_t grain, int chan, juce::int64 from, juce::int64 to, float* dest, juce::int64 destStart) const {
+        from = std::max(from, getStart(grain));
+        to = std::min(to, getEnd(grain));
+        auto k = offsets[grain] + (from - starts[grain]) - delaySamples;
+
+        // Stream samples before the first one pushed read back as the line's initial silence.
+        if (k < 0) {
+            from -= k;
+            k = 0;
+        }
 
-    float process(float input, int delaysamples) {
-        buffer[writepos] = input;
-        int readpos = (writepos - delaysamples + buffersize) % buffersize;
-        float buffoutput = buffer[readpos];
-        writepos = (writepos + 1) % buffersize;
-        return buffoutput;
+        size_t source = static_cast<size_t>(std::upper_bound(offsets.begin(), offsets.end(), k) - offsets.begin()) - 1;
+        while (from < to) {
+            while (k >= offsets[source + 1])
+                source++;
+            auto n = std::min(to - from, offsets[source + 1] - k);
+            juce::FloatVectorOperations::add(dest + (from - destStart),
+                                             buffers[source]->getReadPointer(chan) + (k - offsets[source]),
+                                             static_cast<int>(n));
+            from += n;
+            k += n;
+        }
     }
 
 private:
-    std::vector<float> buffer;
-    int writepos;
-    int buffersize;
+    std::vector<const juce::AudioBuffer<float>*> buffers;
+    std::vector<juce::int64> starts, lengths, offsets;
+    juce::int64 delaySamples;
 };
 
-// Envelope function to shape each grain
-void env(juce::AudioBuffer<float>& buffer, float attacktime, float decaytime, float sustainlevel, float releasetime, float samplerate) {
-
-    if (attacktime <= 0.0f) attacktime = 0.1f;
-    if (decaytime <= 0.0f) decaytime = 0.1f;
-    if (releasetime <= 0.0f) releasetime = 0.1f;
-
-    float totalattacksamples = timetosamples(attacktime, samplerate);
-    float totaldecaysamples  = timetosamples(decaytime, samplerate);
-    float totalreleasesamples = timetosamples(releasetime, samplerate);
-
-    int totalsamples = buffer.getNumSamples();
-    for (int chan = 0; chan < buffer.getNumChannels(); chan++) {
-        float* channelData = buffer.getWritePointer(chan);
-        float attackEnd = totalattacksamples;
-        float decayEnd  = totalattacksamples + totaldecaysamples;
-        float sustainEnd = totalsamples - totalreleasesamples;
-        if (sustainEnd < decayEnd)
-            sustainEnd = decayEnd;
-        
-        for (int i = 0; i < totalsamples; i++) {
-            float amplitude = 0.0f;
-            if (i < attackEnd) {
-                amplitude = static_cast<float>(i) / attackEnd;
-            }
-            else if (i < decayEnd) {
-                amplitude = 1.0f + (static_cast<float>(i) - attackEnd) * ((sustainlevel - 1.0f) / (decayEnd - attackEnd));
-            }
-            else if (i < sustainEnd) {
-                amplitude = sustainlevel;
-            }
-            else {
-                if (totalsamples - 1 > sustainEnd)
-                    amplitude = sustainlevel + (static_cast<float>(i) - sustainEnd) * (-sustainlevel) / (totalsamples - 1 - sustainEnd);
-                else
-                    amplitude = 0.0f;
-            }
-            channelData[i] *= amplitude;
-        }
-    }
-}
+// Per-grain rendering choices, fixed when the grain is spawned
+struct GrainParameters {
+    EnvelopeShape envelope = EnvelopeShape::linearADSR;
+    GrainShape shape;
+    GrainMode mode = GrainMode::timeDomain;
+    float stretch = 1.0f;
+    float pitch = 1.0f;
+    float gain = 1.0f;
+    float pan = 0.0f;  // -1 (left) to 1 (right)
+    GrainFilter filter;
+};
 
-// Grain class: extracts a segment from the input buffer and applies an envelope.
+// Grain class: extracts a segment from its pooled source (or vocodes one, in the spectral modes);
+// applyEnvelope() then shapes it, once it has been filtered. The grain holds its source so the
+// pool can't free it mid-grain.
 class Grain {
 public:
     juce::AudioBuffer<float> buffer;
+    SamplePool::Entry::Ptr source;
 
-    Grain(juce::AudioBuffer<float>& inputBuffer, int startSample, int numSamples, float samplerate) {
+    Grain(SamplePool::Entry::Ptr sourceEntry, int startSample, int numSamples,
+          const GrainParameters& params, PhaseVocoder* vocoder = nullptr)
+        : source(std::move(sourceEntry)) {
+        TRACE_SCOPE("grain");
+        const auto& inputBuffer = source->getBuffer();
         buffer.setSize(inputBuffer.getNumChannels(), numSamples);
-        for (int chan = 0; chan < inputBuffer.getNumChannels(); chan++) {
-            const float* src = inputBuffer.getReadPointer(chan);
-            float* dest = buffer.getWritePointer(chan);
-            std::copy(src + startSample, src + startSample + numSamples, dest);
+        if (params.mode != GrainMode::timeDomain && vocoder != nullptr) {
+            renderSpectralGrain(*vocoder, inputBuffer, startSample, params.mode, params.stretch, params.pitch, buffer);
         }
+        else {
+            for (int chan = 0; chan < inputBuffer.getNumChannels(); chan++) {
+                const float* src = inputBuffer.getReadPointer(chan);
+                float* dest = buffer.getWritePointer(chan);
+                std::copy(src + startSample, src + startSample + numSamples, dest);
+            }
+        }
+    }
+
+    void applyEnvelope(const GrainParameters& params) {
+        // The envelope shape is resolved to a specialised renderer once, here at spawn.
+        TRACE_SCOPE("envelope");
+        const int numSamples = buffer.getNumSamples();
+        auto renderEnvelope = getGrainRenderer<float>(params.envelope);
+        renderEnvelope(buffer.getArrayOfReadPointers(), buffer.getArrayOfWritePointers(),
+                       buffer.getNumChannels(), numSamples, params.shape, params.gain);
 
-        env(buffer, 0.01f, 0.01f, 0.8f, 0.01f, samplerate);
+        // Balance pan: centre leaves both sides untouched, hard left silences the right.
+        if (params.pan != 0.0f && buffer.getNumChannels() == 2) {
+            buffer.applyGain(0, 0, numSamples, juce::jmin(1.0f, 1.0f - params.pan));
+            buffer.applyGain(1, 0, numSamples, juce::jmin(1.0f, 1.0f + params.pan));
+        }
     }
 };
 
-int main() {
+int main(int argc, char* argv[]) {
     // Input and output file paths
     std::string inputwav = "/Users/apple/Desktop/Spring25/granBasics/input.wav";
     std::string outputwav = "/Users/apple/Desktop/Spring25/granBasics/grain1.wav";
@@ -94,79 +137,361 @@ int main() {
     juce::File inputfile(inputwav);
     juce::File outputfile(outputwav);
 
+    // "--replay <log> [output]" re-renders exactly the grains recorded in a .grainlog, from the
+    // source and settings it names, instead of scheduling new ones
+    bool replay = argc > 2 && juce::String(argv[1]) == "--replay";
+    GrainLogHeader logged {};
+    std::vector<GrainEvent> events;
+    if (replay) {
+        auto cwd = juce::File::getCurrentWorkingDirectory();
+        if (!readGrainLog(cwd.getChildFile(argv[2]), logged, inputfile, events)) {
+            std::cout << "Failed to read grain log." << std::endl;
+            return 1;
+        }
+        outputfile = argc > 3 ? cwd.getChildFile(argv[3])
+                              : outputfile.getSiblingFile(outputfile.getFileNameWithoutExtension() + "_replay.wav");
+    }
+
+    // Set GRANULAR_TRACE_FILE to record a timeline of every stage (Chrome trace JSON)
+    auto traceFile = juce::SystemStats::getEnvironmentVariable("GRANULAR_TRACE_FILE", {});
+    Trace::Session trace(juce::File::getCurrentWorkingDirectory().getChildFile(traceFile), traceFile.isNotEmpty());
+
     // Set up JUCE audio formats
     juce::AudioFormatManager formatManager;
     formatManager.registerBasicFormats();
 
-    // Open the input file
-    std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(inputfile));
-    if (!reader) {
+    // Load the source through the shared pool, converted to the engine rate so that sources
+    // recorded at any rate keep their pitch and timing
+    const double engineRate = 48000.0;
+    DecodedSourceCache decodeCache;
+    SamplePool samplePool(engineRate, 512 * 1024 * 1024, &decodeCache);
+    SamplePool::Entry::Ptr source;
+    {
+        TRACE_SCOPE("read");
+        source = samplePool.load(inputfile);
+    }
+    if (!source->isReady()) {
         std::cout << "Failed to open input file." << std::endl;
         return 1;
     }
 
-    int samplerate   = static_cast<int>(reader->sampleRate);
-    int totalsamples = static_cast<int>(reader->lengthInSamples);
-    int numchannels  = reader->numChannels;
+    const juce::AudioBuffer<float>& inputBuffer = source->getBuffer();
 
-    // Read the entire file into a buffer
-    juce::AudioBuffer<float> inputBuffer;
-    inputBuffer.setSize(numchannels, totalsamples);
-    reader->read(&inputBuffer, 0, totalsamples, 0, true, true);
+    int samplerate   = static_cast<int>(engineRate);
+    int totalsamples = inputBuffer.getNumSamples();
+    int numchannels  = inputBuffer.getNumChannels();
 
     // Set grain and scheduling parameters
     float grainDurationSec     = 0.1f; 
     float timeBetweenGrainsSec = 0.1f; 
     int grainSamples     = static_cast<int>(timetosamples(grainDurationSec, samplerate));
     int interonsetSamples = static_cast<int>(timetosamples(timeBetweenGrainsSec, samplerate));
+    bool snapGrainsToOnsets    = true;
+
+    GrainParameters grainParams;
+    grainParams.envelope = EnvelopeShape::curvedADSR;
+    grainParams.shape.attack  = static_cast<int>(timetosamples(0.01f, samplerate));
+    grainParams.shape.decay   = static_cast<int>(timetosamples(0.01f, samplerate));
+    grainParams.shape.release = static_cast<int>(timetosamples(0.01f, samplerate));
+    grainParams.shape.sustain = 0.8f;
+    grainParams.shape.curve   = 4.0f;
+    grainParams.mode    = GrainMode::timeDomain;
+    grainParams.stretch = 4.0f;  // spectralStretch mode: source time per grain is grain length / stretch
+    grainParams.pitch   = 1.0f;
+
+    // Every grain gets its own low-pass, its cutoff drawn from its seed
+    GrainFilterSettings grainFilter;
+    grainFilter.type      = static_cast<juce::int32>(GrainFilterType::lowPass);
+    grainFilter.minCutoff = 800.0f;
+    grainFilter.maxCutoff = 8000.0f;
+    grainFilter.resonance = 0.9f;
+
+    // Modulation of each grain as it is spawned, evaluated every 32 samples: a slow drift of pan
+    // and density, random jitter of the read position, and shorter grains where the source is loud
+    ModulationMatrix modulation;
+    modulation.prepare(engineRate, 32);
+    const int panDrift = modulation.addSource(ModulationSource::lfo(ModulationSource::Shape::sine, 0.2f));
+    const int densityDrift = modulation.addSource(ModulationSource::lfo(ModulationSource::Shape::triangle, 0.05f));
+    const int jitter = modulation.addSource(ModulationSource::sampleAndHold(5.0f, 1));
+    const int level = modulation.addSource(ModulationSource::envelopeFollower(5.0f, 200.0f));
+    modulation.addRoute(panDrift, ModulationTarget::pan, 0.5f);
+    modulation.addRoute(densityDrift, ModulationTarget::density, 0.5f);
+    modulation.addRoute(jitter, ModulationTarget::position, 0.02f);
+    modulation.addRoute(level, ModulationTarget::grainSize, -1.0f);
+    modulation.setFollowerInput(&inputBuffer);
 
     // Determine how many grains can be extracted from the input buffer
     int numGrains = (totalsamples - grainSamples) / interonsetSamples + 1;
-    std::vector<Grain> grains;
-    grains.reserve(numGrains);
-
-    // Extract grains from the input buffer
-    for (int i = 0; i < numGrains; i++) {
-        int startSample = i * interonsetSamples;
-        if (startSample + grainSamples > totalsamples)
-            break;
-        grains.emplace_back(inputBuffer, startSample, grainSamples, static_cast<float>(samplerate));
-    }
 
     // Compute the length of the final output (to accommodate scheduled grains)
     int finalOutputLength = (numGrains - 1) * interonsetSamples + grainSamples;
+    int delaySamples = interonsetSamples;
+
+    if (replay) {
+        // Everything that shapes the render comes from the log, not from the settings above
+        if (logged.sampleRate != engineRate || static_cast<int>(logged.numChannels) != numchannels) {
+            std::cout << "Grain log does not match its source." << std::endl;
+            return 1;
+        }
+        finalOutputLength = static_cast<int>(logged.outputLength);
+        delaySamples = logged.delaySamples;
+        grainParams.envelope = static_cast<EnvelopeShape>(logged.envelope);
+        grainParams.shape = logged.shape;
+        grainParams.mode = static_cast<GrainMode>(logged.mode);
+        grainParams.stretch = logged.stretch;
+        grainFilter = logged.filter;
+    }
+    else {
+        // Map the source's analysis index (building it next to the file on first use)
+        SourceAnalysisIndex analysis;
+        {
+            TRACE_SCOPE("analysis");
+            if (snapGrainsToOnsets && !analysis.loadOrBuild(inputfile, formatManager))
+                std::cout << "Source analysis failed, using fixed grain positions." << std::endl;
+        }
+
+        // Schedule the grains across the source, each one moved by the modulation at its start
+        TRACE_SCOPE("schedule");
+        const juce::int64 lastSlot = static_cast<juce::int64>(numGrains - 1) * interonsetSamples;
+        juce::uint32 seed = 0;
+        for (juce::int64 time = 0; time <= lastSlot; seed++) {
+            modulation.advanceTo(time);
+            const int interval = juce::jmax(1, juce::roundToInt(interonsetSamples / std::exp2(modulation.getValue(ModulationTarget::density))));
+
+            int startSample = static_cast<int>(time);
+            if (analysis.isLoaded()) {
+                // Start on the next detected onset if it falls before the following grain's slot.
+                // The index counts samples at the file's own rate.
+                double toSource = analysis.getSampleRate() / engineRate;
+                int onset = analysis.findNextOnset(static_cast<juce::int64>(startSample * toSource));
+                if (onset < analysis.getNumOnsets()) {
+                    int onsetSample = static_cast<int>(analysis.getOnset(onset) / toSource);
+                    if (onsetSample < startSample + interval)
+                        startSample = onsetSample;
+                }
+            }
+            if (startSample + grainSamples > totalsamples)
+                break;
+
+            const int length = juce::jlimit(1, totalsamples, juce::roundToInt(grainSamples * std::exp2(modulation.getValue(ModulationTarget::grainSize))));
+            startSample = juce::jlimit(0, totalsamples - length,
+                                       startSample + juce::roundToInt(modulation.getValue(ModulationTarget::position) * engineRate));
+            const float pitch = grainParams.pitch * std::exp2(modulation.getValue(ModulationTarget::pitch) / 12.0f);
+            const float pan = juce::jlimit(-1.0f, 1.0f, grainParams.pan + modulation.getValue(ModulationTarget::pan));
+
+            events.push_back({ time, startSample, length, pitch, grainParams.gain, pan, seed });
+            finalOutputLength = static_cast<int>(std::max<juce::int64>(finalOutputLength, time + length));
+            time += interval;
+        }
+
+        // Log every grain so the render can be replayed
+        GrainLogHeader settings {};
+        settings.numChannels = static_cast<juce::uint32>(numchannels);
+        settings.sampleRate = engineRate;
+        settings.outputLength = finalOutputLength;
+        settings.delaySamples = delaySamples;
+        settings.envelope = static_cast<juce::int32>(grainParams.envelope);
+        settings.shape = grainParams.shape;
+        settings.mode = static_cast<juce::int32>(grainParams.mode);
+        settings.stretch = grainParams.stretch;
+        settings.filter = grainFilter;
+        GrainLogWriter log(getGrainLogFileFor(outputfile), settings, inputfile);
+        for (const auto& e : events)
+            log.log(e);
+    }
+
+    // GRANULAR_RENDER_THREADS sets the number of render threads (default one per CPU).
+    // Rendering is deterministic by default: every output tile sums its grains in schedule order,
+    // so the result is bit-identical whatever the thread count. GRANULAR_DETERMINISTIC=0 lets each
+    // thread mix grains into its own buffer as it finishes them instead, which changes the
+    // summation order from run to run.
+    const int renderThreads = juce::SystemStats::getEnvironmentVariable("GRANULAR_RENDER_THREADS", "0").getIntValue();
+    const bool deterministic = juce::SystemStats::getEnvironmentVariable("GRANULAR_DETERMINISTIC", "1") != "0";
+    const int numWorkers = renderThreads > 0 ? renderThreads : juce::SystemStats::getNumCpus();
+
+    // Grains are rendered up to the first event that falls outside the source
+    size_t numRendered = 0;
+    while (numRendered < events.size() && events[numRendered].sourcePosition >= 0
+           && events[numRendered].sourcePosition + events[numRendered].length <= totalsamples)
+        numRendered++;
+
+    // Extract grains from the input buffer. A vocoder starts afresh for every grain, so each
+    // thread can keep its own.
+    std::vector<PhaseVocoder> vocoders(static_cast<size_t>(numWorkers));
+    if (grainParams.mode != GrainMode::timeDomain)
+        for (auto& vocoder : vocoders)
+            vocoder.prepare(numchannels);
+
+    // Grains are spawned a filter bank group at a time: extracted, filtered together, then shaped
+    const int groupSize = GrainFilterBank::groupSize;
+    const int numGroups = static_cast<int>((numRendered + static_cast<size_t>(groupSize) - 1) / static_cast<size_t>(groupSize));
+    std::vector<std::unique_ptr<Grain>> grains(numRendered);
+    {
+        TRACE_SCOPE("grain extraction");
+        parallelFor(numGroups, numWorkers, [&](int group, int thread) {
+            const size_t first = static_cast<size_t>(group) * static_cast<size_t>(groupSize);
+            const size_t count = std::min(numRendered - first, static_cast<size_t>(groupSize));
+            GrainParameters params[GrainFilterBank::groupSize];
+            juce::AudioBuffer<float>* buffers[GrainFilterBank::groupSize];
+            GrainFilterCoefficients coefficients[GrainFilterBank::groupSize];
+
+            for (size_t k = 0; k < count; k++) {
+                const auto& e = events[first + k];
+                auto random = getGrainRandom(e.seed);
+                params[k] = grainParams;
+                params[k].pitch = e.pitch;
+                params[k].gain = e.gain;
+                params[k].pan = e.pan;
+                params[k].filter = GrainFilter::fromSettings(grainFilter, random);
+                grains[first + k] = std::make_unique<Grain>(source, static_cast<int>(e.sourcePosition), e.length,
+                                                            params[k], &vocoders[static_cast<size_t>(thread)]);
+                buffers[k] = &grains[first + k]->buffer;
+                coefficients[k] = GrainFilterCoefficients::make(params[k].filter, engineRate);
+            }
+            {
+                TRACE_SCOPE("grain filters");
+                GrainFilterBank::process(buffers, coefficients, static_cast<int>(count));
+            }
+            for (size_t k = 0; k < count; k++)
+                grains[first + k]->applyEnvelope(params[k]);
+        });
+    }
+
     juce::AudioBuffer<float> outputBuffer;
     outputBuffer.setSize(numchannels, finalOutputLength);
     outputBuffer.clear();
 
-    // Create one delay (circular buffer) per channel.
-    std::vector<Circularbuff> delayLines;
-    int delayBufferSize = finalOutputLength; 
-    for (int chan = 0; chan < numchannels; chan++) {
-        delayLines.emplace_back(delayBufferSize);
-    }
-    int delaySamples = interonsetSamples; 
-
-    // Process each grain:
-    // For each grain, process its samples through the delay line and schedule it in the final output.
-    for (int i = 0; i < static_cast<int>(grains.size()); i++) {
-        int grainStart = i * interonsetSamples;
-        Grain& g = grains[i];
-        int grainNumSamples = g.buffer.getNumSamples();
-        for (int chan = 0; chan < numchannels; chan++) {
-            const float* grainData = g.buffer.getReadPointer(chan);
-            float* outData = outputBuffer.getWritePointer(chan);
-            for (int j = 0; j < grainNumSamples; j++) {
-                int pos = grainStart + j;
-                if (pos < finalOutputLength) {
-                    float delayedSample = delayLines[chan].process(grainData[j], delaySamples);
-                    outData[pos] += delayedSample;
-                }
+    // Each grain passes through a delay line before it is scheduled in the final output
+    std::vector<const juce::AudioBuffer<float>*> grainBuffers;
+    std::vector<juce::int64> grainStarts;
+    std::vector<GrainMapEntry> grainMap;
+    for (size_t i = 0; i < numRendered; i++) {
+        grainBuffers.push_back(&grains[i]->buffer);
+        grainStarts.push_back(events[i].time);
+        grainMap.push_back({ events[i].time, grains[i]->buffer.getNumSamples(),
+                             static_cast<juce::int32>(grainParams.envelope), grainParams.shape, 0 });
+    }
+    DelayedGrainStream stream(grainBuffers, grainStarts, finalOutputLength, delaySamples);
+
+    {
+        TRACE_SCOPE("delay and mix");
+        if (deterministic) {
+            // Bucket grains by the tiles they touch, keeping schedule order within each tile
+            const int tileSize = 32768;
+            const int numTiles = (finalOutputLength + tileSize - 1) / tileSize;
+            std::vector<std::vector<size_t>> tileGrains(static_cast<size_t>(numTiles));
+            for (size_t i = 0; i < stream.getNumGrains(); i++) {
+                if (stream.getEnd(i) <= stream.getStart(i))
+                    continue;
+                for (auto tile = stream.getStart(i) / tileSize; tile <= (stream.getEnd(i) - 1) / tileSize; tile++)
+                    tileGrains[static_cast<size_t>(tile)].push_back(i);
             }
+
+            // Taken once: getWritePointer() marks the buffer as not clear, a race if every tile did it
+            float* const* out = outputBuffer.getArrayOfWritePointers();
+            parallelFor(numTiles, numWorkers, [&](int tile, int) {
+                TRACE_SCOPE("mix tile");
+                const juce::int64 from = static_cast<juce::int64>(tile) * tileSize;
+                const juce::int64 to = std::min<juce::int64>(from + tileSize, finalOutputLength);
+                for (int chan = 0; chan < numchannels; chan++)
+                    for (auto i : tileGrains[static_cast<size_t>(tile)])
+                        stream.mixGrain(i, chan, from, to, out[chan], 0);
+            });
+        }
+        else {
+            // Each thread mixes whichever grains it picks up into its own buffer, then the
+            // buffers are summed
+            std::vector<juce::AudioBuffer<float>> partials(static_cast<size_t>(numWorkers - 1));
+            parallelFor(static_cast<int>(stream.getNumGrains()), numWorkers, [&](int i, int thread) {
+                auto& dest = thread == 0 ? outputBuffer : partials[static_cast<size_t>(thread - 1)];
+                if (dest.getNumSamples() == 0) {
+                    dest.setSize(numchannels, finalOutputLength);
+                    dest.clear();
+                }
+                for (int chan = 0; chan < numchannels; chan++)
+                    stream.mixGrain(static_cast<size_t>(i), chan, 0, finalOutputLength, dest.getWritePointer(chan), 0);
+            });
+            for (auto& partial : partials)
+                if (partial.getNumSamples() > 0)
+                    for (int chan = 0; chan < numchannels; chan++)
+                        outputBuffer.addFrom(chan, 0, partial, chan, 0, finalOutputLength);
         }
     }
 
+    // GRANULAR_IR=<file> convolves the mix with an impulse response (a reverb, say), offline in
+    // large partitions across the render threads; GRANULAR_IR_MIX sets the wet share (default
+    // 0.3). The render grows by the IR's tail.
+    auto impulseFile = juce::SystemStats::getEnvironmentVariable("GRANULAR_IR", {});
+    if (impulseFile.isNotEmpty()) {
+        ConvolutionStage convolution;
+        if (!convolution.loadImpulseResponse(juce::File::getCurrentWorkingDirectory().getChildFile(impulseFile),
+                                             engineRate, formatManager, true, &decodeCache)) {
+            std::cout << "Failed to open impulse response." << std::endl;
+            return 1;
+        }
+        const float wet = juce::jlimit(0.0f, 1.0f, juce::SystemStats::getEnvironmentVariable("GRANULAR_IR_MIX", "0.3").getFloatValue());
+
+        TRACE_SCOPE("convolve");
+        auto convolved = convolution.process(outputBuffer, ConvolutionStage::Mode::offline, numWorkers);
+        convolved.applyGain(wet);
+        for (int chan = 0; chan < numchannels; chan++)
+            convolved.addFrom(chan, 0, outputBuffer, chan, 0, finalOutputLength, 1.0f - wet);
+        outputBuffer = std::move(convolved);
+        finalOutputLength = outputBuffer.getNumSamples();
+    }
+
+    // Overlapping grains easily sum past full scale. Either of two options scales the whole render
+    // first, and then a lookahead true-peak limiter keeps everything under the ceiling before the
+    // 16-bit writer:
+    //   GRANULAR_LOUDNESS=<LUFS> to an integrated loudness, metered once over the mix in memory;
+    //   that measurement, scaled by the gain, is also the loudness reported at the end.
+    //   GRANULAR_NORMALIZE=<dBTP> so the true peak lands there (measured in one pass, applied in
+    //   a second).
+    // They would fight over the same gain, so the loudness target wins when both are set.
+    const float ceilingDb = -1.0f;
+    const int limiterBlockSize = 4096;
+    auto loudnessTarget = juce::SystemStats::getEnvironmentVariable("GRANULAR_LOUDNESS", {});
+    auto normalizeTarget = juce::SystemStats::getEnvironmentVariable("GRANULAR_NORMALIZE", {});
+    if (loudnessTarget.isNotEmpty() && normalizeTarget.isNotEmpty()) {
+        std::cout << "GRANULAR_LOUDNESS and GRANULAR_NORMALIZE are both set; ignoring GRANULAR_NORMALIZE." << std::endl;
+        normalizeTarget = {};
+    }
+
+    LoudnessMeter loudness;
+    loudness.prepare(engineRate, numchannels);
+    const bool loudnessMeasured = loudnessTarget.isNotEmpty();
+    double loudnessGainDb = 0.0;
+    if (loudnessMeasured) {
+        TRACE_SCOPE("loudness normalize");
+        loudness.process(outputBuffer, 0, finalOutputLength);
+        const float gain = loudness.getGainToTarget(loudnessTarget.getDoubleValue());
+        loudnessGainDb = juce::Decibels::gainToDecibels(gain, -1000.0f);
+        outputBuffer.applyGain(0, finalOutputLength, gain);
+    }
+
+    if (normalizeTarget.isNotEmpty()) {
+        TRACE_SCOPE("normalize");
+        PeakNormalizer normalizer;
+        normalizer.prepare(numchannels, limiterBlockSize);
+        normalizer.measure(outputBuffer, 0, finalOutputLength);
+        normalizer.finishMeasuring();
+        normalizer.apply(outputBuffer, 0, finalOutputLength, normalizer.getGain(normalizeTarget.getFloatValue()));
+    }
+
+    // The limiter's output lags its input, so run it on past the end and write from its latency on
+    LookaheadLimiter limiter;
+    limiter.prepare(engineRate, numchannels, limiterBlockSize, ceilingDb);
+    const int latency = limiter.getLatencySamples();
+    outputBuffer.setSize(numchannels, finalOutputLength + latency, true, true);
+    {
+        TRACE_SCOPE("limit");
+        limiter.process(outputBuffer, 0, outputBuffer.getNumSamples());
+    }
+    if (limiter.getLowestGain() < 1.0f)
+        std::cout << "Limiter reduced peaks by up to " << -juce::Decibels::gainToDecibels(limiter.getLowestGain()) << " dB." << std::endl;
+
     // Write the final output buffer to a WAV file
+    outputfile.deleteFile();
     std::unique_ptr<juce::FileOutputStream> fileStream(outputfile.createOutputStream());
     if (!fileStream) {
         std::cout << "Failed to create output stream." << std::endl;
@@ -176,7 +501,7 @@ int main() {
     std::unique_ptr<juce::AudioFormatWriter> writer(
         formatManager.findFormatForFileExtension("wav")->createWriterFor(
             fileStream.get(),
-            reader->sampleRate,
+            engineRate,
             static_cast<unsigned int>(numchannels),
             16,
             {},
@@ -186,9 +511,32 @@ int main() {
         std::cout << "Failed to create writer." << std::endl;
         return 1;
     }
+    fileStream.release();  // the writer owns the stream now
+
+    // Write in blocks, summarising each into the peak pyramid, and into the loudness meter unless
+    // the mix was already metered, on the way past
+    PeakPyramid peaks(numchannels);
+    {
+        TRACE_SCOPE("write");
+        const int writeBlockSize = 65536;
+        for (int pos = 0; pos < finalOutputLength; pos += writeBlockSize) {
+            int n = juce::jmin(writeBlockSize, finalOutputLength - pos);
+            writer->writeFromAudioSampleBuffer(outputBuffer, latency + pos, n);
+            peaks.addSamples(outputBuffer, latency + pos, n);
+            if (!loudnessMeasured)
+                loudness.process(outputBuffer, latency + pos, n);
+        }
+        writer.reset();
+        peaks.finish();
+        if (!peaks.save(PeakPyramid::getSidecarFileFor(outputfile), engineRate))
+            std::cout << "Failed to write peak sidecar." << std::endl;
+    }
 
-    writer->writeFromAudioSampleBuffer(outputBuffer, 0, outputBuffer.getNumSamples());
+    // Record where each grain landed, for drawing over the output with Visual
+    if (!writeGrainMap(getGrainMapFileFor(outputfile), engineRate, grainMap))
+        std::cout << "Failed to write grain map." << std::endl;
 
+    std::cout << "Loudness: " << loudness.getSummary(loudnessGainDb) << "." << std::endl;
     std::cout << "Granular synthesis processing complete." << std::endl;
     return 0;
 }
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "ParallelRender.h"
+
+// Grain parameters a modulation route can move. A route's depth is in the target's unit.
+enum class ModulationTarget {
+    grainSize = 0,  // octaves: the grain's length is scaled by 2^value
+    density,        // octaves: grains per second are scaled by 2^value
+    position,       // seconds added to the grain's source position
+    pitch,          // semitones
+    pan,            // added to the pan (-1 to 1)
+    numTargets
+};
+
+// One modulation source, stepped once per control tick. LFOs and sample-and-hold sources swing
+// from -1 to 1; an envelope follower goes from 0 (silence) to 1 (full scale).
+struct ModulationSource {
+    enum class Kind { lfo, sampleAndHold, envelopeFollower };
+    enum class Shape { sine, triangle, sawUp, square };
+
+    Kind kind = Kind::lfo;
+    Shape shape = Shape::sine;
+    float rate = 1.0f;        // Hz: LFO cycles, or new random values, per second
+    float startPhase = 0.0f;  // LFO phase at sample 0, in cycles
+    juce::uint32 seed = 0;    // sample-and-hold random stream
+    float attackMs = 10.0f, releaseMs = 200.0f;
+
+    static ModulationSource lfo(Shape shape, float rateHz, float startPhase = 0.0f) {
+        ModulationSource s;
+        s.shape = shape;
+        s.rate = rateHz;
+        s.startPhase = startPhase;
+        return s;
+    }
+
+    static ModulationSource sampleAndHold(float rateHz, juce::uint32 seed) {
+        ModulationSource s;
+        s.kind = Kind::sampleAndHold;
+        s.rate = rateHz;
+        s.seed = seed;
+        return s;
+    }
+
+    static ModulationSource envelopeFollower(float attackMs, float releaseMs) {
+        ModulationSource s;
+        s.kind = Kind::envelopeFollower;
+        s.attackMs = attackMs;
+        s.releaseMs = releaseMs;
+        return s;
+    }
+};
+
+// Routes modulation sources to grain parameters. The sources are evaluated at a control rate (one
+// tick every controlInterval samples) and each target's value is interpolated linearly between
+// ticks, so a grain is modulated by reading getValue() once when it is spawned; nothing is
+// evaluated per sample of a grain.
+//
+// Time only moves forward, through advanceTo(). Everything is stepped from sample 0 in order (the
+// random streams come from their seeds), so the same routes give the same values on every run.
+class ModulationMatrix {
+public:
+    void prepare(double sampleRate, int controlInterval = 32) {
+        rate = sampleRate;
+        interval = juce::jmax(1, controlInterval);
+        reset();
+    }
+
+    // Returns the new source's index, for addRoute().
+    int addSource(const ModulationSource& source) {
+        SourceState state;
+        state.settings = source;
+        sources.push_back(state);
+        reset();
+        return static_cast<int>(sources.size()) - 1;
+    }
+
+    void addRoute(int source, ModulationTarget target, float depth) {
+        jassert(juce::isPositiveAndBelow(source, static_cast<int>(sources.size())));
+        routes.push_back({ source, target, depth });
+        reset();
+    }
+
+    // The signal the envelope followers track, read at the matrix's own sample positions (silence
+    // past its end). It must outlive the matrix, or be replaced before the next advanceTo().
+    void setFollowerInput(const juce::AudioBuffer<float>* signal) { followerInput = signal; }
+
+    void reset() {
+        for (auto& s : sources) {
+            s.random = getGrainRandom(s.settings.seed);
+            s.hold = -1;
+            s.value = 0.0f;
+        }
+        tick = 0;
+        position = 0;
+        evaluate(0, next);
+        std::copy(std::begin(next), std::end(next), std::begin(previous));
+    }
+
+    // Moves to output sample `sample` (no earlier than the last), running the control ticks up to
+    // the one after it.
+    void advanceTo(juce::int64 sample) {
+        jassert(sample >= position);
+        position = juce::jmax(position, sample);
+        const juce::int64 last = position / interval + 1;
+        while (tick < last) {
+            std::copy(std::begin(next), std::end(next), std::begin(previous));
+            evaluate(++tick, next);
+        }
+    }
+
+    // The summed modulation of target at the current sample, in the target's unit.
+    float getValue(ModulationTarget target) const {
+        const auto t = static_cast<size_t>(target);
+        const float fraction = static_cast<float>(position % interval) / static_cast<float>(interval);
+        return previous[t] + fraction * (next[t] - previous[t]);
+    }
+
+private:
+    static constexpr auto numTargets = static_cast<size_t>(ModulationTarget::numTargets);
+
+    struct SourceState {
+        ModulationSource settings;
+        juce::Random random;
+        juce::int64 hold = -1;
+        float value = 0.0f;
+    };
+
+    struct Route {
+        int source;
+        ModulationTarget target;
+        float depth;
+    };
+
+    // Steps every source to control tick t (at sample t * interval) and sums the routes.
+    void evaluate(juce::int64 t, float* values) {
+        const auto time = static_cast<double>(t * interval) / rate;
+        for (auto& s : sources) {
+            const auto& settings = s.settings;
+            switch (settings.kind) {
+                case ModulationSource::Kind::lfo: {
+                    // Phase from the tick number, so no error builds up over a long render
+                    const double cycles = settings.startPhase + time * settings.rate;
+                    s.value = lfoShape(settings.shape, static_cast<float>(cycles - std::floor(cycles)));
+                    break;
+                }
+                case ModulationSource::Kind::sampleAndHold: {
+                    const auto hold = static_cast<juce::int64>(std::floor(time * settings.rate));
+                    while (s.hold < hold) {
+                        s.value = s.random.nextFloat() * 2.0f - 1.0f;
+                        s.hold++;
+                    }
+                    break;
+                }
+                case ModulationSource::Kind::envelopeFollower:
+                    if (t > 0)
+                        s.value = followLevel(settings, s.value, (t - 1) * interval);
+                    break;
+            }
+        }
+
+        std::fill(values, values + numTargets, 0.0f);
+        for (const auto& route : routes)
+            values[static_cast<size_t>(route.target)] += sources[static_cast<size_t>(route.source)].value * route.depth;
+    }
+
+    static float lfoShape(ModulationSource::Shape shape, float phase) {
+        switch (shape) {
+            case ModulationSource::Shape::sine:     return std::sin(juce::MathConstants<float>::twoPi * phase);
+            case ModulationSource::Shape::triangle: return 1.0f - 4.0f * std::abs(phase - 0.5f);
+            case ModulationSource::Shape::sawUp:    return 2.0f * phase - 1.0f;
+            case ModulationSource::Shape::square:   return phase < 0.5f ? 1.0f : -1.0f;
+        }
+        return 0.0f;
+    }
+
+    // The follower's level after the control interval starting at sample start: the interval's
+    // peak across channels, approached with the attack or release time.
+    float followLevel(const ModulationSource& settings, float level, juce::int64 start) const {
+        float peak = 0.0f;
+        if (followerInput != nullptr && start < followerInput->getNumSamples()) {
+            const int n = static_cast<int>(std::min<juce::int64>(interval, followerInput->getNumSamples() - start));
+            for (int chan = 0; chan < followerInput->getNumChannels(); chan++) {
+                const auto range = juce::FloatVectorOperations::findMinAndMax(followerInput->getReadPointer(chan, static_cast<int>(start)), n);
+                peak = juce::jmax(peak, -range.getStart(), range.getEnd());
+            }
+        }
+        peak = juce::jmin(1.0f, peak);
+
+        const float ms = peak > level ? settings.attackMs : settings.releaseMs;
+        const auto coefficient = static_cast<float>(std::exp(-interval / juce::jmax(1.0, rate * ms * 0.001)));
+        return peak + coefficient * (level - peak);
+    }
+
+    double rate = 48000.0;
+    int interval = 32;
+    std::vector<SourceState> sources;
+    std::vector<Route> routes;
+    const juce::AudioBuffer<float>* followerInput = nullptr;
+
+    juce::int64 tick = 0, position = 0;
+    float previous[numTargets] {}, next[numTargets] {};
+};
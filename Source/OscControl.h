@@ -0,0 +1,149 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <atomic>
+#include <vector>
+#include "GranularInstrument.h"
+
+// Drives a GranularInstrument over OSC (UDP), for show-control systems. Addresses, under /grawr:
+//
+//   /grain/length f     grain length, seconds        /envelope/attack f    seconds
+//   /grain/density f    grains per second per note   /envelope/decay f     seconds
+//   /grain/spread f     position jitter, seconds     /envelope/sustain f   level, 0 to 1
+//   /grain/panSpread f  0 to 1                       /envelope/release f   seconds
+//   /grain/gain f       per grain, at full velocity
+//   /grain/rootNote f   MIDI note
+//
+//   /trigger position length [pitch gain pan]  one grain: position 0 to 1 through the source,
+//                                              length in seconds, pitch in semitones
+//
+// Any argument can be an int or a float, and bundles and address wildcards work. Messages are
+// decoded on the receiver's own thread and handed to the audio thread as fixed-size commands
+// through a preallocated single-reader, single-writer FIFO; applyTo() drains it with no locks and
+// no allocation. A full FIFO drops the command and counts it.
+class OscControl : private juce::OSCReceiver::Listener<juce::OSCReceiver::RealtimeCallback> {
+public:
+    explicit OscControl(int queueSize = 16384) : receiver("OSC control"), fifo(queueSize), commands(static_cast<size_t>(queueSize)) {
+        const char* names[] = { "/grawr/grain/length", "/grawr/grain/density", "/grawr/grain/spread",
+                                "/grawr/grain/panSpread", "/grawr/grain/gain", "/grawr/grain/rootNote",
+                                "/grawr/envelope/attack", "/grawr/envelope/decay", "/grawr/envelope/sustain",
+                                "/grawr/envelope/release", "/grawr/trigger" };
+        for (int i = 0; i < numTargets; i++)
+            addresses.emplace_back(names[i]);
+        receiver.addListener(this);
+    }
+
+    ~OscControl() override { disconnect(); }
+
+    bool connect(int port) { return receiver.connect(port); }
+    void disconnect() { receiver.disconnect(); }
+
+    // Applies every command received since the last call, in the order they arrived. Call it from
+    // the audio thread, before the instrument's processBlock().
+    void applyTo(GranularInstrument& instrument) {
+        auto parameters = instrument.getParameters();
+        bool changed = false;
+
+        fifo.read(fifo.getNumReady()).forEach([&](int index) {
+            const auto& c = commands[static_cast<size_t>(index)];
+            const float v = c.values[0];
+            switch (c.target) {
+                case grainLength:     parameters.grainLength = juce::jmax(0.001f, v); break;
+                case density:         parameters.density = juce::jmax(0.01f, v); break;
+                case spread:          parameters.spread = juce::jmax(0.0f, v); break;
+                case panSpread:       parameters.panSpread = juce::jlimit(0.0f, 1.0f, v); break;
+                case gain:            parameters.gain = juce::jmax(0.0f, v); break;
+                case rootNote:        parameters.rootNote = v; break;
+                case envelopeAttack:  parameters.envelope.attack = juce::jmax(0.0f, v); break;
+                case envelopeDecay:   parameters.envelope.decay = juce::jmax(0.0f, v); break;
+                case envelopeSustain: parameters.envelope.sustain = juce::jlimit(0.0f, 1.0f, v); break;
+                case envelopeRelease: parameters.envelope.release = juce::jmax(0.0f, v); break;
+                case trigger:
+                    instrument.triggerGrain(c.values[0], c.values[1], c.values[2], c.values[3], c.values[4]);
+                    numApplied++;
+                    return;
+                default: return;
+            }
+            changed = true;
+            numApplied++;
+        });
+
+        if (changed)
+            instrument.setParameters(parameters);
+    }
+
+    juce::int64 getNumReceived() const { return numReceived.load(); }
+    juce::int64 getNumApplied() const { return numApplied.load(); }
+    juce::int64 getNumDropped() const { return numDropped.load(); }
+    juce::int64 getNumUnrecognised() const { return numUnrecognised.load(); }
+
+private:
+    enum Target {
+        grainLength, density, spread, panSpread, gain, rootNote,
+        envelopeAttack, envelopeDecay, envelopeSustain, envelopeRelease, trigger, numTargets
+    };
+
+    struct Command {
+        int target;
+        float values[5];
+    };
+
+    // On the receiver's thread
+    void oscMessageReceived(const juce::OSCMessage& message) override {
+        numReceived++;
+        bool recognised = false;
+        for (int i = 0; i < numTargets; i++) {
+            if (!message.getAddressPattern().matches(addresses[static_cast<size_t>(i)]))
+                continue;
+
+            // A trigger needs a position and length and defaults the rest; a parameter needs its value
+            Command c { i, { 0.0f, 0.0f, 0.0f, 0.1f, 0.0f } };
+            const int required = i == trigger ? 2 : 1;
+            const int count = juce::jmin(message.size(), i == trigger ? 5 : 1);
+            if (message.size() < required || !readFloats(message, c.values, count))
+                continue;
+
+            recognised = true;
+            push(c);
+        }
+        if (!recognised)
+            numUnrecognised++;
+    }
+
+    void oscBundleReceived(const juce::OSCBundle& bundle) override {
+        for (const auto& element : bundle) {
+            if (element.isMessage())
+                oscMessageReceived(element.getMessage());
+            else if (element.isBundle())
+                oscBundleReceived(element.getBundle());
+        }
+    }
+
+    static bool readFloats(const juce::OSCMessage& message, float* values, int count) {
+        for (int i = 0; i < count; i++) {
+            const auto& argument = message[i];
+            if (argument.isFloat32())
+                values[i] = argument.getFloat32();
+            else if (argument.isInt32())
+                values[i] = static_cast<float>(argument.getInt32());
+            else
+                return false;
+        }
+        return true;
+    }
+
+    void push(const Command& c) {
+        if (fifo.getFreeSpace() == 0) {
+            numDropped++;
+            return;
+        }
+        fifo.write(1).forEach([&](int index) { commands[static_cast<size_t>(index)] = c; });
+    }
+
+    juce::OSCReceiver receiver;
+    std::vector<juce::OSCAddress> addresses;
+
+    juce::AbstractFifo fifo;
+    std::vector<Command> commands;
+    std::atomic<juce::int64> numReceived { 0 }, numApplied { 0 }, numDropped { 0 }, numUnrecognised { 0 };
+};
@@ -0,0 +1,140 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <JuceHeader.h>
+#include "OscControl.h"
+
+// Per-block timings of a paced "audio thread": mean, 99th percentile and worst, in ms.
+struct BlockTimes {
+    std::vector<double> ms;
+
+    juce::String getSummary() const {
+        auto sorted = ms;
+        std::sort(sorted.begin(), sorted.end());
+        double total = 0.0;
+        for (auto t : sorted)
+            total += t;
+        return "mean " + juce::String(total / static_cast<double>(sorted.size()), 3) + " ms, 99th percentile "
+               + juce::String(sorted[sorted.size() * 99 / 100], 3) + " ms, worst " + juce::String(sorted.back(), 3) + " ms";
+    }
+};
+
+// Tests OSC control over local loopback UDP: an instrument holding a chord is run block by block
+// in real time, first with no OSC traffic and then while another thread sends it parameter
+// changes and grain triggers at a fixed rate. Reports how many messages arrived, were applied or
+// were dropped, the audio blocks' timings with and without the traffic, and how much of each
+// block went on draining the queue.
+int main(int argc, char* argv[]) {
+    std::string inputwav = "/Users/apple/Desktop/Spring25/granBasics/input.wav";
+    int port = 9001;
+    double phaseSec = 5.0;
+    int messagesPerSecond = 10000;
+
+    if (argc > 1) inputwav = argv[1];
+    if (argc > 2) port = std::atoi(argv[2]);
+    if (argc > 3) phaseSec = std::atof(argv[3]);
+    if (argc > 4) messagesPerSecond = std::atoi(argv[4]);
+
+    const double samplerate = 48000.0;
+    const int blockSize = 512;
+    const int numchannels = 2;
+
+    SamplePool samplePool(samplerate, 512 * 1024 * 1024);
+    auto source = samplePool.load(juce::File::getCurrentWorkingDirectory().getChildFile(inputwav));
+    if (!source->isReady()) {
+        std::cout << "Failed to open input file." << std::endl;
+        return 1;
+    }
+
+    GranularInstrument instrument;
+    instrument.setSource(source, samplerate);
+    instrument.getSynthesiser().enableLegacyMode(2, juce::Range<int>(1, 17));
+    instrument.prepare(samplerate, blockSize, numchannels);
+
+    OscControl control;
+    if (!control.connect(port)) {
+        std::cout << "Failed to open OSC port " << port << "." << std::endl;
+        return 1;
+    }
+
+    juce::OSCSender sender;
+    if (!sender.connect("127.0.0.1", port)) {
+        std::cout << "Failed to connect OSC sender." << std::endl;
+        return 1;
+    }
+
+    // Sends in bursts every millisecond: mostly parameter changes, every tenth a grain trigger. The
+    // last message sets a density the audio thread should end up with.
+    std::atomic<bool> sending { false }, stop { false };
+    std::atomic<juce::int64> numSent { 0 };
+    const float finalDensity = 123.0f;
+    std::thread traffic([&] {
+        juce::Random random(7);
+        auto next = std::chrono::steady_clock::now();
+        const int perBurst = juce::jmax(1, messagesPerSecond / 1000);
+        while (!stop) {
+            next += std::chrono::milliseconds(1);
+            std::this_thread::sleep_until(next);
+            if (!sending)
+                continue;
+            for (int i = 0; i < perBurst; i++) {
+                const auto n = numSent++;
+                if (n % 10 == 0)
+                    sender.send("/grawr/trigger", random.nextFloat(), 0.05f, random.nextFloat() * 12.0f - 6.0f, 0.05f, random.nextFloat() * 2.0f - 1.0f);
+                else if (n % 2 == 0)
+                    sender.send("/grawr/grain/density", 50.0f + random.nextFloat() * 150.0f);
+                else
+                    sender.send("/grawr/grain/spread", random.nextFloat() * 0.1f);
+            }
+        }
+    });
+
+    // Render in real time, each block paced to its deadline as an audio callback would be
+    juce::AudioBuffer<float> block(numchannels, blockSize);
+    juce::MidiBuffer midi;
+    for (int k = 0; k < 8; k++)
+        midi.addEvent(juce::MidiMessage::noteOn(k + 1, 48 + k * 4, 0.8f), 0);
+
+    const auto blockDuration = std::chrono::duration<double>(blockSize / samplerate);
+    auto runPhase = [&](BlockTimes& times, BlockTimes& drains) {
+        const auto start = std::chrono::steady_clock::now();
+        const auto numBlocks = static_cast<int>(phaseSec * samplerate / blockSize);
+        for (int b = 0; b < numBlocks; b++) {
+            block.clear();
+            const auto t0 = juce::Time::getHighResolutionTicks();
+            control.applyTo(instrument);
+            const auto t1 = juce::Time::getHighResolutionTicks();
+            instrument.processBlock(block, midi);
+            drains.ms.push_back(juce::Time::highResolutionTicksToSeconds(t1 - t0) * 1000.0);
+            times.ms.push_back(juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - t0) * 1000.0);
+            midi.clear();
+            std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(blockDuration * (b + 1)));
+        }
+    };
+
+    BlockTimes quiet, busy, quietDrains, busyDrains;
+    runPhase(quiet, quietDrains);
+    sending = true;
+    runPhase(busy, busyDrains);
+    sending = false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    sender.send("/grawr/grain/density", finalDensity);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    control.applyTo(instrument);
+    stop = true;
+    traffic.join();
+    control.disconnect();
+
+    const auto sent = numSent.load() + 1;
+    std::cout << "Sent " << sent << " messages (" << static_cast<double>(sent - 1) / phaseSec << " per second), received "
+              << control.getNumReceived() << ", applied " << control.getNumApplied() << ", dropped "
+              << control.getNumDropped() << ", unrecognised " << control.getNumUnrecognised() << "." << std::endl;
+    std::cout << "Final density " << instrument.getParameters().density << " (sent " << finalDensity << ")." << std::endl;
+    std::cout << "Blocks without OSC: " << quiet.getSummary() << "." << std::endl;
+    std::cout << "Blocks with OSC:    " << busy.getSummary() << "." << std::endl;
+    std::cout << "Draining the queue: " << busyDrains.getSummary() << "." << std::endl;
+    return instrument.getParameters().density == finalDensity ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "Trace.h"
+
+// Formats whose readers seek to an exact sample, so a segment decoded from its own seek point
+// matches the same samples decoded straight through. MP3 (frame-granular seeking with decoder
+// warm-up) and anything unknown are read serially.
+inline bool hasSampleExactSeeking(const juce::AudioFormatReader& reader) {
+    const auto& name = reader.getFormatName();
+    return name == "FLAC file" || name == "Ogg-Vorbis file" || name == "WAV file" || name == "AIFF file";
+}
+
+// Decodes a whole source into dest, splitting long files with exact seeking into one segment
+// per thread. Each segment opens its own reader, seeks to its first sample and decodes straight
+// into its slice of dest, so the result is identical to a serial read.
+inline bool readWholeSource(const juce::File& source, juce::AudioFormatManager& formatManager,
+                            juce::AudioBuffer<float>& dest, double& sampleRate, int numThreads = 0) {
+    std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(source));
+    if (!reader)
+        return false;
+
+    const juce::int64 length = reader->lengthInSamples;
+    sampleRate = reader->sampleRate;
+    dest.setSize(static_cast<int>(reader->numChannels), static_cast<int>(length));
+
+    // Segments shorter than this don't repay opening another reader.
+    const juce::int64 minSegmentLength = juce::int64(1) << 19;
+    if (numThreads <= 0)
+        numThreads = juce::SystemStats::getNumCpus();
+    numThreads = static_cast<int>(std::clamp<juce::int64>(numThreads, 1, std::max<juce::int64>(1, length / minSegmentLength)));
+
+    if (numThreads == 1 || !hasSampleExactSeeking(*reader))
+        return reader->read(&dest, 0, static_cast<int>(length), 0, true, true);
+
+    // Readers are opened up front, one per segment; the first segment reuses the open one.
+    std::vector<std::unique_ptr<juce::AudioFormatReader>> readers;
+    readers.push_back(std::move(reader));
+    for (int t = 1; t < numThreads; t++) {
+        readers.emplace_back(formatManager.createReaderFor(source));
+        if (readers.back() == nullptr)
+            return false;
+    }
+
+    // The channel pointers are taken once, here: getWritePointer() marks the buffer as not clear,
+    // so calling it from every worker would race on that flag.
+    float* const* channels = dest.getArrayOfWritePointers();
+    const int numChannels = dest.getNumChannels();
+
+    std::vector<std::thread> workers;
+    std::atomic<bool> failed { false };
+    const juce::int64 perThread = (length + numThreads - 1) / numThreads;
+
+    for (int t = 0; t < numThreads; t++) {
+        const auto first = t * perThread;
+        const auto last = std::min(length, first + perThread);
+        if (first >= last)
+            break;
+
+        workers.emplace_back([&, t, first, last] {
+            TRACE_THREAD_NAME("decoder worker");
+            TRACE_SCOPE("decode segment");
+            std::vector<float*> slice(static_cast<size_t>(numChannels));
+            for (int chan = 0; chan < numChannels; chan++)
+                slice[static_cast<size_t>(chan)] = channels[chan] + first;
+
+            auto& r = *readers[static_cast<size_t>(t)];
+            if (!r.read(slice.data(), numChannels, first, static_cast<int>(last - first)))
+                failed = true;
+        });
+    }
+
+    for (auto& w : workers)
+        w.join();
+
+    return !failed;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "Trace.h"
+
+// Runs fn(index, threadIndex) for every index in [0, count), handing indices out to numThreads
+// workers (0 = one per CPU) as they finish the last. The calling thread is worker 0.
+template <typename Function>
+void parallelFor(int count, int numThreads, Function&& fn) {
+    if (numThreads <= 0)
+        numThreads = juce::SystemStats::getNumCpus();
+    numThreads = juce::jlimit(1, juce::jmax(1, count), numThreads);
+
+    std::atomic<int> next { 0 };
+    auto work = [&](int thread) {
+        for (int i = next++; i < count; i = next++)
+            fn(i, thread);
+    };
+
+    std::vector<std::thread> workers;
+    for (int t = 1; t < numThreads; t++) {
+        workers.emplace_back([&work, t] {
+            TRACE_THREAD_NAME("render worker " + juce::String(t));
+            work(t);
+        });
+    }
+    work(0);
+    for (auto& w : workers)
+        w.join();
+}
+
+// The random stream for one grain, seeded from the grain's own seed (GrainEvent::seed) rather than
+// from whichever thread renders it, so random choices don't change with the thread count. The
+// seed is scrambled first (splitmix64) so neighbouring grains get unrelated streams.
+inline juce::Random getGrainRandom(juce::uint32 grainSeed, juce::uint64 renderSeed = 0) {
+    juce::uint64 z = renderSeed + (static_cast<juce::uint64>(grainSeed) + 1) * 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return juce::Random(static_cast<juce::int64>(z ^ (z >> 31)));
+}
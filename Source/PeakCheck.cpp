@@ -0,0 +1,71 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <JuceHeader.h>
+#include "PeakPyramid.h"
+
+// Checks PeakPyramid against a brute-force scan, for signals of many bucket counts, including
+// ones that are not powers of two and end in a partial bucket, both in memory and from a saved
+// .peaks sidecar. The whole signal's min and max must match the samples' own; any other span,
+// summarised from whole buckets, must at least cover them. Each signal has a spike in its last
+// bucket, which the coarse levels must still reach. Returns 1 on any mismatch.
+int main() {
+    const int bucketSize = 256;
+    const int numchannels = 2;
+    juce::Random random(36);
+    auto sidecar = juce::File::createTempFile(".peaks");
+    int failures = 0, numChecked = 0;
+
+    auto check = [&](const char* what, int numBuckets, juce::int64 start, juce::int64 end, const PeakBucket& got,
+                     const PeakBucket& expected, bool exact, float tolerance) {
+        numChecked++;
+        const bool covers = got.min <= expected.min + tolerance && got.max >= expected.max - tolerance;
+        if (covers && (!exact || (got.min >= expected.min - tolerance && got.max <= expected.max + tolerance)))
+            return;
+        if (++failures <= 10)
+            std::cout << what << ", " << numBuckets << " buckets, [" << start << ", " << end << "): min " << got.min
+                      << " max " << got.max << ", expected min " << expected.min << " max " << expected.max << std::endl;
+    };
+
+    for (int numBuckets = 1; numBuckets <= 40; numBuckets++) {
+        for (int partial : { 0, 100 }) {
+            const int n = numBuckets * bucketSize + partial;
+            juce::AudioBuffer<float> buffer(numchannels, n);
+            for (int chan = 0; chan < numchannels; chan++) {
+                auto* x = buffer.getWritePointer(chan);
+                for (int i = 0; i < n; i++)
+                    x[i] = (random.nextFloat() * 2.0f - 1.0f) * 0.1f;
+                x[n - 1 - random.nextInt(juce::jmin(n, bucketSize))] = chan == 0 ? 0.9f : -0.9f;
+            }
+
+            auto peaks = PeakPyramid::fromBuffer(buffer, bucketSize);
+            PeakPyramidFile mapped;
+            if (!peaks.save(sidecar, 48000.0) || !mapped.open(sidecar)) {
+                std::cout << "Failed to save or open the sidecar." << std::endl;
+                return 1;
+            }
+
+            // The whole signal, then its tail, then random spans
+            std::vector<std::pair<juce::int64, juce::int64>> ranges { { 0, n }, { n / 2, n } };
+            for (int k = 0; k < 20; k++) {
+                const int a = random.nextInt(n), b = random.nextInt(n);
+                ranges.emplace_back(juce::jmin(a, b), juce::jmax(a, b) + 1);
+            }
+
+            for (int chan = 0; chan < numchannels; chan++) {
+                for (const auto& [start, end] : ranges) {
+                    const auto* x = buffer.getReadPointer(chan);
+                    const auto [lo, hi] = std::minmax_element(x + start, x + end);
+                    const PeakBucket expected { *lo, *hi, 0.0f };
+                    const bool whole = start == 0 && end == n;
+                    check("In memory", numBuckets, start, end, peaks.getRange(chan, start, end), expected, whole, 0.0f);
+                    check("Sidecar", numBuckets, start, end, mapped.getRange(chan, start, end), expected, whole, 1.0f / 32767.0f);
+                }
+            }
+        }
+    }
+    sidecar.deleteFile();
+
+    std::cout << numChecked << " ranges checked, " << failures << " wrong." << std::endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,325 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// Minimum, maximum and RMS of a run of samples.
+struct PeakBucket {
+    float min;
+    float max;
+    float rms;
+};
+
+// Buckets as stored in a .peaks sidecar: each value scaled by 32767 and clamped, as
+// juce::AudioThumbnail quantises its min/max data, to keep long renders' sidecars small.
+struct PackedPeakBucket {
+    juce::int16 min;
+    juce::int16 max;
+    juce::int16 rms;
+};
+
+// Header of a "<audio>.peaks" sidecar, followed by juce::uint64 levelSizes[numLevels] and then,
+// level by level and channel by channel within each level, PackedPeakBucket[levelSizes[level]].
+struct PeakPyramidHeader {
+    char magic[8];
+    juce::uint32 version;
+    juce::uint32 numChannels;
+    juce::uint32 bucketSize;
+    juce::uint32 numLevels;
+    double sampleRate;
+    juce::int64 numSamples;
+    juce::int64 reserved;
+};
+
+static_assert(sizeof(PackedPeakBucket) == 6, "packed bucket layout must stay fixed");
+static_assert(sizeof(PeakPyramidHeader) == 48, "pyramid header layout must stay fixed");
+
+namespace PeakPyramidDetail {
+    inline PeakBucket merge(const PeakBucket& a, const PeakBucket& b) {
+        return { juce::jmin(a.min, b.min), juce::jmax(a.max, b.max), std::sqrt((a.rms * a.rms + b.rms * b.rms) * 0.5f) };
+    }
+
+    inline juce::int16 pack(float x) {
+        return static_cast<juce::int16>(juce::jlimit(-32767, 32767, juce::roundToInt(x * 32767.0f)));
+    }
+
+    inline PeakBucket unpack(const PackedPeakBucket& b) {
+        return { b.min * (1.0f / 32767.0f), b.max * (1.0f / 32767.0f), b.rms * (1.0f / 32767.0f) };
+    }
+
+    // Picks the coarsest level whose buckets still fit twice into [start, end), then merges the
+    // two to four buckets covering the span: constant cost at any zoom. getBucket(level, index)
+    // and levelSize(level) abstract over where the buckets live.
+    template <typename GetBucket, typename LevelSize>
+    PeakBucket query(int bucketSize, int numLevels, juce::int64 start, juce::int64 end,
+                     GetBucket&& getBucket, LevelSize&& levelSize) {
+        const juce::int64 span = std::max<juce::int64>(1, end - start);
+
+        int level = 0;
+        while (level + 1 < numLevels && (static_cast<juce::int64>(bucketSize) << (level + 1)) <= span / 2)
+            level++;
+
+        const juce::int64 count = levelSize(level);
+        if (count == 0)
+            return { 0.0f, 0.0f, 0.0f };
+
+        const juce::int64 size = static_cast<juce::int64>(bucketSize) << level;
+        auto first = std::clamp<juce::int64>(start / size, 0, count - 1);
+        auto last = std::clamp<juce::int64>((end - 1) / size, first, count - 1);
+
+        PeakBucket result = getBucket(level, first);
+        float sumSquares = result.rms * result.rms;
+        for (auto i = first + 1; i <= last; i++) {
+            auto b = getBucket(level, i);
+            result.min = juce::jmin(result.min, b.min);
+            result.max = juce::jmax(result.max, b.max);
+            sumSquares += b.rms * b.rms;
+        }
+        result.rms = std::sqrt(sumSquares / static_cast<float>(last - first + 1));
+        return result;
+    }
+}
+
+// Multi-resolution min/max/RMS summary of a signal for drawing waveforms.
+//
+// Level 0 holds one bucket per bucketSize samples and every level above merges pairs of the one
+// below, so any span of samples is covered by a handful of buckets from a suitable level. Samples
+// are added in blocks, so a pyramid can be built while a file is streamed or written, and then
+// saved as a sidecar that PeakPyramidFile maps.
+class PeakPyramid {
+public:
+    explicit PeakPyramid(int numChannels = 1, int samplesPerBucket = 256)
+        : bucketSize(samplesPerBucket), channels(static_cast<size_t>(numChannels)) {
+        for (auto& c : channels)
+            c.levels.resize(1);
+        channelPointers.resize(channels.size());
+    }
+
+    int getNumChannels() const { return static_cast<int>(channels.size()); }
+    int getBucketSize() const { return bucketSize; }
+    juce::int64 getNumSamples() const { return numSamples; }
+
+    // Consumed a bucket-aligned run at a time, so the min/max scan and sum of squares are
+    // straight loops over contiguous samples.
+    void addSamples(const float* const* data, int n) {
+        for (size_t chan = 0; chan < channels.size(); chan++) {
+            auto& c = channels[chan];
+            for (int i = 0; i < n;) {
+                const int run = juce::jmin(n - i, bucketSize - c.pendingCount);
+                const float* x = data[chan] + i;
+                auto range = juce::FloatVectorOperations::findMinAndMax(x, run);
+                double squares = 0.0;
+                for (int k = 0; k < run; k++)
+                    squares += x[k] * x[k];
+
+                c.pendingMin = c.pendingCount == 0 ? range.getStart() : juce::jmin(c.pendingMin, range.getStart());
+                c.pendingMax = c.pendingCount == 0 ? range.getEnd() : juce::jmax(c.pendingMax, range.getEnd());
+                c.pendingSquares += squares;
+                c.pendingCount += run;
+                if (c.pendingCount == bucketSize)
+                    flushPending(c);
+                i += run;
+            }
+        }
+        numSamples += n;
+    }
+
+    void addSamples(const juce::AudioBuffer<float>& buffer, int start, int n) {
+        for (size_t chan = 0; chan < channels.size(); chan++)
+            channelPointers[chan] = buffer.getReadPointer(static_cast<int>(chan), start);
+        addSamples(channelPointers.data(), n);
+    }
+
+    // Flushes the partial bucket at the end of the signal. Call once after the last addSamples().
+    void finish() {
+        for (auto& c : channels) {
+            if (c.pendingCount > 0)
+                flushPending(c);
+
+            // A level's last odd bucket has no partner; carry it up on its own, merging it with a
+            // waiting left partner where there is one, until a single bucket covers every sample.
+            bool carrying = false;
+            PeakBucket carry {};
+            for (size_t level = 0;; level++) {
+                if (level == c.levels.size()) {
+                    if (!carrying)
+                        break;
+                    c.levels.emplace_back();
+                }
+                auto& buckets = c.levels[level];
+                if (carrying)
+                    buckets.push_back(carry);
+
+                if (buckets.size() % 2 == 1) {
+                    carry = buckets.back();
+                    carrying = buckets.size() > 1 || level + 1 < c.levels.size();
+                } else if (carrying) {
+                    carry = PeakPyramidDetail::merge(buckets[buckets.size() - 2], buckets.back());
+                }
+            }
+        }
+    }
+
+    static PeakPyramid fromBuffer(const juce::AudioBuffer<float>& buffer, int samplesPerBucket = 256) {
+        PeakPyramid p(buffer.getNumChannels(), samplesPerBucket);
+        p.addSamples(buffer.getArrayOfReadPointers(), buffer.getNumSamples());
+        p.finish();
+        return p;
+    }
+
+    // Summary of samples [start, end) of one channel.
+    PeakBucket getRange(int chan, juce::int64 start, juce::int64 end) const {
+        const auto& levels = channels[static_cast<size_t>(chan)].levels;
+        return PeakPyramidDetail::query(bucketSize, static_cast<int>(levels.size()), start, end,
+            [&](int level, juce::int64 i) { return levels[static_cast<size_t>(level)][static_cast<size_t>(i)]; },
+            [&](int level) { return static_cast<juce::int64>(levels[static_cast<size_t>(level)].size()); });
+    }
+
+    bool isEmpty() const { return channels.empty() || channels[0].levels[0].empty(); }
+
+    static juce::File getSidecarFileFor(const juce::File& audio) {
+        return audio.getSiblingFile(audio.getFileName() + ".peaks");
+    }
+
+    // Writes the finished pyramid in the format PeakPyramidFile maps.
+    bool save(const juce::File& file, double sampleRate) const {
+        // Every channel has the same number of levels and buckets; channel 0 gives the layout.
+        const auto& levels = channels.front().levels;
+
+        PeakPyramidHeader h {};
+        std::memcpy(h.magic, "GRNPEAK\0", 8);
+        h.version = 1;
+        h.numChannels = static_cast<juce::uint32>(channels.size());
+        h.bucketSize = static_cast<juce::uint32>(bucketSize);
+        h.numLevels = static_cast<juce::uint32>(levels.size());
+        h.sampleRate = sampleRate;
+        h.numSamples = numSamples;
+
+        juce::TemporaryFile temp(file);
+        {
+            juce::FileOutputStream out(temp.getFile());
+            if (!out.openedOk())
+                return false;
+
+            out.write(&h, sizeof(h));
+            for (auto& level : levels) {
+                auto size = static_cast<juce::uint64>(level.size());
+                out.write(&size, sizeof(size));
+            }
+
+            std::vector<PackedPeakBucket> packed;
+            for (size_t level = 0; level < levels.size(); level++) {
+                for (auto& c : channels) {
+                    packed.clear();
+                    for (auto& b : c.levels[level])
+                        packed.push_back({ PeakPyramidDetail::pack(b.min), PeakPyramidDetail::pack(b.max), PeakPyramidDetail::pack(b.rms) });
+                    out.write(packed.data(), packed.size() * sizeof(PackedPeakBucket));
+                }
+            }
+
+            out.flush();
+            if (out.getStatus().failed())
+                return false;
+        }
+        return temp.overwriteTargetFileWithTemporary();
+    }
+
+private:
+    struct Channel {
+        std::vector<std::vector<PeakBucket>> levels;
+        float pendingMin = 0.0f, pendingMax = 0.0f;
+        double pendingSquares = 0.0;
+        int pendingCount = 0;
+    };
+
+    static void flushPending(Channel& c) {
+        push(c, 0, { c.pendingMin, c.pendingMax, static_cast<float>(std::sqrt(c.pendingSquares / c.pendingCount)) });
+        c.pendingSquares = 0.0;
+        c.pendingCount = 0;
+    }
+
+    // Appends a bucket to a level, merging each completed pair into the level above.
+    static void push(Channel& c, size_t level, PeakBucket bucket) {
+        for (;;) {
+            if (c.levels.size() <= level)
+                c.levels.emplace_back();
+            auto& buckets = c.levels[level];
+            buckets.push_back(bucket);
+            if (buckets.size() % 2 != 0)
+                return;
+
+            bucket = PeakPyramidDetail::merge(buckets[buckets.size() - 2], bucket);
+            level++;
+        }
+    }
+
+    int bucketSize;
+    juce::int64 numSamples = 0;
+    std::vector<Channel> channels;
+    std::vector<const float*> channelPointers;
+};
+
+// A memory-mapped .peaks sidecar. Queries read the few buckets they need straight from the
+// mapping, so opening and drawing a pyramid for hours of audio touches almost none of it.
+class PeakPyramidFile {
+public:
+    bool open(const juce::File& file) {
+        mapped = std::make_unique<juce::MemoryMappedFile>(file, juce::MemoryMappedFile::readOnly);
+        levelOffsets.clear();
+
+        auto* data = static_cast<const char*>(mapped->getData());
+        if (data == nullptr || mapped->getSize() < sizeof(PeakPyramidHeader))
+            return fail();
+
+        std::memcpy(&header, data, sizeof(header));
+        if (std::memcmp(header.magic, "GRNPEAK\0", 8) != 0 || header.version != 1 || header.numChannels == 0
+            || header.bucketSize == 0 || header.numLevels == 0 || header.numLevels > 64)
+            return fail();
+
+        size_t offset = sizeof(PeakPyramidHeader) + header.numLevels * sizeof(juce::uint64);
+        if (mapped->getSize() < offset)
+            return fail();
+
+        sizes = reinterpret_cast<const juce::uint64*>(data + sizeof(PeakPyramidHeader));
+        for (juce::uint32 level = 0; level < header.numLevels; level++) {
+            levelOffsets.push_back(offset);
+            offset += static_cast<size_t>(sizes[level]) * header.numChannels * sizeof(PackedPeakBucket);
+        }
+        if (mapped->getSize() < offset)
+            return fail();
+
+        return true;
+    }
+
+    bool isOpen() const { return !levelOffsets.empty(); }
+    int getNumChannels() const { return static_cast<int>(header.numChannels); }
+    int getBucketSize() const { return static_cast<int>(header.bucketSize); }
+    double getSampleRate() const { return header.sampleRate; }
+    juce::int64 getNumSamples() const { return header.numSamples; }
+
+    PeakBucket getRange(int chan, juce::int64 start, juce::int64 end) const {
+        auto* data = static_cast<const char*>(mapped->getData());
+        return PeakPyramidDetail::query(getBucketSize(), static_cast<int>(header.numLevels), start, end,
+            [&](int level, juce::int64 i) {
+                auto* buckets = reinterpret_cast<const PackedPeakBucket*>(data + levelOffsets[static_cast<size_t>(level)]);
+                return PeakPyramidDetail::unpack(buckets[static_cast<size_t>(chan) * sizes[level] + static_cast<size_t>(i)]);
+            },
+            [&](int level) { return static_cast<juce::int64>(sizes[level]); });
+    }
+
+private:
+    bool fail() {
+        levelOffsets.clear();
+        mapped.reset();
+        return false;
+    }
+
+    std::unique_ptr<juce::MemoryMappedFile> mapped;
+    PeakPyramidHeader header {};
+    const juce::uint64* sizes = nullptr;
+    std::vector<size_t> levelOffsets;
+};
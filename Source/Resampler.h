@@ -0,0 +1,267 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <thread>
+#include <vector>
+#include "DecodedSourceCache.h"
+#include "Trace.h"
+
+// Polyphase windowed-sinc sample rate converter for whole buffers.
+//
+// The conversion ratio is reduced to upFactor / downFactor, and one Kaiser-windowed sinc filter
+// is precomputed per output phase (up to maxPhases, beyond which the nearest phase is used).
+// Each output sample is a single SIMD dot product between its phase's taps and the input.
+class PolyphaseResampler {
+public:
+    using Register = juce::dsp::SIMDRegister<float>;
+    static constexpr int maxPhases = 4096;
+
+    PolyphaseResampler(double inputRate, double outputRate, int halfTapsAtUnity = 32) {
+        auto in = static_cast<juce::int64>(std::llround(inputRate));
+        auto out = static_cast<juce::int64>(std::llround(outputRate));
+        auto divisor = std::gcd(in, out);
+        upFactor = out / divisor;
+        downFactor = in / divisor;
+        numPhases = static_cast<int>(std::min<juce::int64>(upFactor, maxPhases));
+
+        // Downsampling narrows the passband, so the filter gets proportionally longer to keep
+        // the same transition width. Taps are padded to a whole number of SIMD registers.
+        const double ratio = static_cast<double>(upFactor) / static_cast<double>(downFactor);
+        const int width = static_cast<int>(Register::size());
+        halfTaps = static_cast<int>(std::ceil(halfTapsAtUnity * juce::jmax(1.0, 1.0 / ratio)));
+        halfTaps = (halfTaps + width - 1) / width * width;
+        numTaps = 2 * halfTaps;
+
+        const double cutoff = 0.5 * juce::jmin(1.0, ratio) * 0.92;  // cycles per input sample
+        const double beta = 9.0;                                     // about 90 dB stopband
+
+        coefficientStorage.resize(static_cast<size_t>(numPhases * numTaps + width), 0.0f);
+        coefficients = Register::getNextSIMDAlignedPtr(coefficientStorage.data());
+
+        for (int p = 0; p < numPhases; p++) {
+            const double frac = static_cast<double>(p) / numPhases;
+            float* taps = coefficients + p * numTaps;
+            double sum = 0.0;
+            for (int j = 0; j < numTaps; j++) {
+                // Distance, in input samples, between this tap and the output instant.
+                double t = (j - halfTaps + 1) - frac;
+                double x = 2.0 * cutoff * t;
+                double sinc = std::abs(x) < 1.0e-9 ? 1.0 : std::sin(juce::MathConstants<double>::pi * x) / (juce::MathConstants<double>::pi * x);
+                double r = t / halfTaps;
+                double window = std::abs(r) >= 1.0 ? 0.0 : besselI0(beta * std::sqrt(1.0 - r * r)) / besselI0(beta);
+                double h = 2.0 * cutoff * sinc * window;
+                taps[j] = static_cast<float>(h);
+                sum += h;
+            }
+
+            // Unity DC gain for every phase.
+            for (int j = 0; j < numTaps; j++)
+                taps[j] = static_cast<float>(taps[j] / sum);
+        }
+    }
+
+    bool isIdentity() const { return upFactor == downFactor; }
+
+    juce::int64 getOutputLength(juce::int64 inputLength) const {
+        return (inputLength * upFactor + downFactor - 1) / downFactor;
+    }
+
+    // Converts every channel of input into output (sized to getOutputLength()), splitting the
+    // output into one contiguous segment per thread.
+    void process(const juce::AudioBuffer<float>& input, juce::AudioBuffer<float>& output, int numThreads = 0) const {
+        const auto outputLength = static_cast<juce::int64>(output.getNumSamples());
+        if (numThreads <= 0)
+            numThreads = juce::SystemStats::getNumCpus();
+        numThreads = static_cast<int>(std::clamp<juce::int64>(numThreads, 1, std::max<juce::int64>(1, outputLength / 65536)));
+
+        // The channel pointers are taken once, here: getWritePointer() marks the buffer as not
+        // clear, so calling it from every worker would race on that flag.
+        const float* const* in = input.getArrayOfReadPointers();
+        float* const* out = output.getArrayOfWritePointers();
+        const int numChannels = output.getNumChannels();
+        const juce::int64 inputLength = input.getNumSamples();
+
+        std::vector<std::thread> workers;
+        const juce::int64 perThread = (outputLength + numThreads - 1) / numThreads;
+        for (int t = 0; t < numThreads; t++) {
+            auto first = t * perThread;
+            auto last = std::min(outputLength, first + perThread);
+            if (first >= last)
+                break;
+
+            workers.emplace_back([this, in, out, numChannels, inputLength, first, last] {
+                TRACE_THREAD_NAME("resampler worker");
+                TRACE_SCOPE("resample segment");
+                for (int chan = 0; chan < numChannels; chan++)
+                    processSegment(in[chan], inputLength, out[chan], first, last);
+            });
+        }
+
+        for (auto& w : workers)
+            w.join();
+    }
+
+    // Renders output samples [first, last) of one channel.
+    void processSegment(const float* input, juce::int64 inputLength, float* output,
+                        juce::int64 first, juce::int64 last) const {
+        const int width = static_cast<int>(Register::size());
+        const juce::int64 blockSize = 16384;
+        std::vector<float> storage;
+
+        for (juce::int64 blockStart = first; blockStart < last; blockStart += blockSize) {
+            const auto blockEnd = std::min(last, blockStart + blockSize);
+
+            // Input span the block's filters touch.
+            const juce::int64 spanStart = inputIndex(blockStart) - halfTaps + 1;
+            const juce::int64 spanEnd = inputIndex(blockEnd - 1) + halfTaps + 1;
+            const int spanLength = static_cast<int>(spanEnd - spanStart);
+
+            // One copy of the span per alignment offset, so every dot product reads aligned registers:
+            // copy k holds input[spanStart + k + j] at j, and input offset s lives at copy (s % width), index s - s % width.
+            const int stride = (spanLength + 2 * width - 1) / width * width;
+            storage.assign(static_cast<size_t>(stride * width + width), 0.0f);
+            float* copies = Register::getNextSIMDAlignedPtr(storage.data());
+            for (int k = 0; k < width; k++) {
+                // Only the part of the span inside the input is copied; the rest stays silent.
+                auto from = std::clamp<juce::int64>(spanStart + k, 0, inputLength);
+                auto to = std::clamp<juce::int64>(spanEnd, 0, inputLength);
+                if (from < to)
+                    std::copy(input + from, input + to, copies + k * stride + (from - spanStart - k));
+            }
+
+            for (auto n = blockStart; n < blockEnd; n++) {
+                const int offset = static_cast<int>(inputIndex(n) - halfTaps + 1 - spanStart);
+                const int k = offset % width;
+                const float* x = copies + k * stride + (offset - k);
+                const float* h = coefficients + phaseIndex(n) * numTaps;
+
+                auto acc = Register::expand(0.0f);
+                for (int j = 0; j < numTaps; j += width)
+                    acc += Register::fromRawArray(x + j) * Register::fromRawArray(h + j);
+                output[n] = acc.sum();
+            }
+        }
+    }
+
+private:
+    juce::int64 inputIndex(juce::int64 outputIndex) const { return outputIndex * downFactor / upFactor; }
+
+    int phaseIndex(juce::int64 outputIndex) const {
+        auto remainder = (outputIndex * downFactor) % upFactor;
+        return static_cast<int>(remainder * numPhases / upFactor);
+    }
+
+    static double besselI0(double x) {
+        double sum = 1.0, term = 1.0;
+        for (int k = 1; k < 50; k++) {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+            if (term < sum * 1.0e-12)
+                break;
+        }
+        return sum;
+    }
+
+    juce::int64 upFactor = 1, downFactor = 1;
+    int numPhases = 1, halfTaps = 0, numTaps = 0;
+    std::vector<float> coefficientStorage;
+    float* coefficients = nullptr;
+};
+
+// Header of a "<source>.<rate>.resampled" cache file, followed by planar float32 channel data.
+struct ResampledCacheHeader {
+    char magic[8];
+    juce::uint32 numChannels;
+    juce::uint32 reserved;
+    double sampleRate;
+    double sourceRate;
+    juce::int64 numSamples;
+    juce::int64 sourceFileSize;
+    juce::int64 sourceModTime;
+};
+
+static_assert(sizeof(ResampledCacheHeader) == 56, "cache header layout must stay fixed");
+
+inline juce::File getResampledCacheFile(const juce::File& source, double engineRate) {
+    return source.getSiblingFile(source.getFileName() + "." + juce::String(juce::roundToInt(engineRate)) + ".resampled");
+}
+
+// Reads a whole source into dest at engineRate, converting it if the file's rate differs.
+// Conversions are cached next to the source and reused while the source is unchanged.
+// Compressed sources are decoded through decodeCache when one is given.
+inline bool loadSourceAtRate(const juce::File& source, double engineRate, juce::AudioFormatManager& formatManager,
+                             juce::AudioBuffer<float>& dest, DecodedSourceCache* decodeCache = nullptr) {
+    auto cacheFile = getResampledCacheFile(source, engineRate);
+    if (cacheFile.existsAsFile()) {
+        juce::MemoryMappedFile mapped(cacheFile, juce::MemoryMappedFile::readOnly);
+        if (mapped.getData() != nullptr && mapped.getSize() >= sizeof(ResampledCacheHeader)) {
+            auto* h = static_cast<const ResampledCacheHeader*>(mapped.getData());
+            auto dataSize = static_cast<size_t>(h->numChannels) * static_cast<size_t>(h->numSamples) * sizeof(float);
+            if (std::memcmp(h->magic, "GRNRSMP\0", 8) == 0
+                && h->sampleRate == engineRate
+                && h->sourceFileSize == source.getSize()
+                && h->sourceModTime == source.getLastModificationTime().toMilliseconds()
+                && mapped.getSize() >= sizeof(ResampledCacheHeader) + dataSize) {
+                auto* data = reinterpret_cast<const float*>(static_cast<const char*>(mapped.getData()) + sizeof(ResampledCacheHeader));
+                dest.setSize(static_cast<int>(h->numChannels), static_cast<int>(h->numSamples));
+                for (int chan = 0; chan < dest.getNumChannels(); chan++)
+                    dest.copyFrom(chan, 0, data + static_cast<size_t>(chan) * static_cast<size_t>(h->numSamples), dest.getNumSamples());
+                return true;
+            }
+        }
+    }
+
+    juce::AudioBuffer<float> original;
+    double sourceRate = 0.0;
+    if (decodeCache != nullptr && DecodedSourceCache::isWorthCaching(source)) {
+        auto decoded = decodeCache->open(source, formatManager);
+        if (!decoded)
+            return false;
+
+        decoded->read(original);
+        sourceRate = decoded->getSampleRate();
+    }
+    else {
+        if (!readWholeSource(source, formatManager, original, sourceRate))
+            return false;
+    }
+
+    PolyphaseResampler resampler(sourceRate, engineRate);
+    if (resampler.isIdentity()) {
+        dest = std::move(original);
+        return true;
+    }
+
+    dest.setSize(original.getNumChannels(), static_cast<int>(resampler.getOutputLength(original.getNumSamples())));
+    resampler.process(original, dest);
+
+    // Failing to write the cache only costs the next load a conversion.
+    ResampledCacheHeader h {};
+    std::memcpy(h.magic, "GRNRSMP\0", 8);
+    h.numChannels = static_cast<juce::uint32>(dest.getNumChannels());
+    h.sampleRate = engineRate;
+    h.sourceRate = sourceRate;
+    h.numSamples = dest.getNumSamples();
+    h.sourceFileSize = source.getSize();
+    h.sourceModTime = source.getLastModificationTime().toMilliseconds();
+
+    juce::TemporaryFile temp(cacheFile);
+    {
+        juce::FileOutputStream out(temp.getFile());
+        if (!out.openedOk())
+            return true;
+
+        out.write(&h, sizeof(h));
+        for (int chan = 0; chan < dest.getNumChannels(); chan++)
+            out.write(dest.getReadPointer(chan), static_cast<size_t>(dest.getNumSamples()) * sizeof(float));
+        out.flush();
+        if (out.getStatus().failed())
+            return true;
+    }
+    temp.overwriteTargetFileWithTemporary();
+    return true;
+}
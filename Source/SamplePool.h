@@ -0,0 +1,191 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Resampler.h"
+#include "Trace.h"
+
+// Shared, immutable source buffers for every grain in a render.
+//
+// Each source is loaded once (at the engine rate, through loadSourceAtRate) into an Entry that
+// never changes after its ready flag is set, so any thread holding an Entry::Ptr can read its
+// samples without locking. Entries are matched on path and modification time, load on a
+// background thread, and the least recently requested ones are dropped when the pool goes over
+// its memory budget. Dropping only releases the pool's reference: a grain that holds the
+// Ptr keeps its source alive until it finishes.
+class SamplePool {
+public:
+    class Entry : public juce::ReferenceCountedObject {
+    public:
+        using Ptr = juce::ReferenceCountedObjectPtr<Entry>;
+
+        Entry(const juce::File& f, juce::int64 modTime) : file(f), modificationTime(modTime) {}
+
+        const juce::File& getFile() const { return file; }
+        juce::int64 getModificationTime() const { return modificationTime; }
+
+        // Once this returns true the buffer is complete and never written again.
+        bool isReady() const { return ready.load(std::memory_order_acquire); }
+        bool hasFailed() const { return failed.load(std::memory_order_acquire); }
+
+        // Only valid after isReady() has returned true.
+        const juce::AudioBuffer<float>& getBuffer() const { return buffer; }
+
+        size_t getMemorySize() const {
+            return static_cast<size_t>(buffer.getNumChannels()) * static_cast<size_t>(buffer.getNumSamples()) * sizeof(float);
+        }
+
+    private:
+        friend class SamplePool;
+
+        const juce::File file;
+        const juce::int64 modificationTime;
+        juce::AudioBuffer<float> buffer;
+        std::atomic<bool> ready { false }, failed { false };
+        juce::uint64 lastUsed = 0;  // guarded by the pool's lock
+    };
+
+    // decodeCache, if given, is used only from the loading thread and must outlive the pool.
+    SamplePool(double engineSampleRate, size_t memoryBudgetBytes, DecodedSourceCache* decodeCache = nullptr)
+        : engineRate(engineSampleRate), budget(memoryBudgetBytes), decodedSources(decodeCache) {
+        formatManager.registerBasicFormats();
+        loader = std::thread([this] { run(); });
+    }
+
+    ~SamplePool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeLoader.notify_all();
+        loader.join();
+    }
+
+    // Returns the entry for a file, queueing it for loading if the pool doesn't hold a current
+    // copy. The entry may not be ready yet; poll isReady() or use load() to wait for it.
+    Entry::Ptr request(const juce::File& file) {
+        const auto modTime = file.getLastModificationTime().toMilliseconds();
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (auto& e : entries) {
+            if (e->file == file && e->modificationTime == modTime) {
+                e->lastUsed = ++clock;
+                return e;
+            }
+        }
+
+        // A changed file gets a new entry; grains still playing the old one keep it.
+        entries.erase(std::remove_if(entries.begin(), entries.end(), [&](const Entry::Ptr& e) { return e->file == file; }),
+                      entries.end());
+
+        Entry::Ptr e = new Entry(file, modTime);
+        e->lastUsed = ++clock;
+        entries.push_back(e);
+        queue.push_back(e);
+        wakeLoader.notify_one();
+        return e;
+    }
+
+    // Requests a file and blocks until it has loaded (or failed to).
+    Entry::Ptr load(const juce::File& file) {
+        auto e = request(file);
+        std::unique_lock<std::mutex> lock(mutex);
+        loaded.wait(lock, [&] { return e->isReady() || e->hasFailed(); });
+        return e;
+    }
+
+    void setMemoryBudget(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = bytes;
+        evict();
+    }
+
+    // Bytes held by loaded entries the pool still references.
+    size_t getMemoryUsage() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return residentBytes();
+    }
+
+    int getNumEntries() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return static_cast<int>(entries.size());
+    }
+
+private:
+    void run() {
+        TRACE_THREAD_NAME("sample pool loader");
+        for (;;) {
+            Entry::Ptr e;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeLoader.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (stopping)
+                    return;
+                e = queue.front();
+                queue.pop_front();
+            }
+
+            // Loading runs unlocked; nothing else touches the buffer until ready is published.
+            TRACE_SCOPE("load source");
+            if (loadSourceAtRate(e->file, engineRate, formatManager, e->buffer, decodedSources))
+                e->ready.store(true, std::memory_order_release);
+            else
+                e->failed.store(true, std::memory_order_release);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                evict();
+            }
+            loaded.notify_all();
+        }
+    }
+
+    size_t residentBytes() const {
+        size_t total = 0;
+        for (auto& e : entries)
+            if (e->isReady())
+                total += e->getMemorySize();
+        return total;
+    }
+
+    // Drops least recently used entries until the pool fits its budget. Entries that are still
+    // loading, or that someone outside the pool still holds, are skipped: dropping them would
+    // free nothing.
+    void evict() {
+        auto total = residentBytes();
+        while (total > budget) {
+            auto oldest = entries.end();
+            for (auto it = entries.begin(); it != entries.end(); ++it) {
+                auto& e = *it;
+                if (e->hasFailed() || (e->isReady() && e->getReferenceCount() == 1))
+                    if (oldest == entries.end() || e->lastUsed < (*oldest)->lastUsed)
+                        oldest = it;
+            }
+            if (oldest == entries.end())
+                break;
+
+            total -= (*oldest)->isReady() ? (*oldest)->getMemorySize() : 0;
+            entries.erase(oldest);
+        }
+    }
+
+    const double engineRate;
+    size_t budget;
+    DecodedSourceCache* decodedSources;
+    juce::AudioFormatManager formatManager;
+
+    mutable std::mutex mutex;
+    std::condition_variable wakeLoader, loaded;
+    std::vector<Entry::Ptr> entries;
+    std::deque<Entry::Ptr> queue;
+    juce::uint64 clock = 0;
+    bool stopping = false;
+
+    std::thread loader;
+};
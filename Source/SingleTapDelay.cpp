@@ -1,6 +1,7 @@
 #include <iostream>
 #include <vector>
 #include <JuceHeader.h>
+#include "Resampler.h"
 
 class Circularbuff {
 public:
@@ -76,22 +77,15 @@ int main() {
    int delaysamples = static_cast<int>(timetosamples(delaytime, samplerate));
 
 
-   //Creating a unique pointer for the reader
-   std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(inputfile));
-
-
-   if (!reader) {
+   //Reading the file into the buffer, converted to the engine rate if it was recorded at another one
+   juce::AudioBuffer<float> buffer;
+   if (!loadSourceAtRate(inputfile, samplerate, formatManager, buffer)) {
        std::cout << "Failed to open input file." << std::endl;
        return 1;
    }
 
 
-   samplerate = static_cast<int>(reader->sampleRate);
-   // Recalculate delay based on actual file
-   delaysamples = static_cast<int>(delaytime * samplerate);
-
-
-   int numChannels = reader->numChannels;
+   int numChannels = buffer.getNumChannels();
    std::vector<Circularbuff> delaybuff;
 
 
@@ -100,14 +94,6 @@ int main() {
    }
 
 
-   //Creating the JUCE Audio Buffer
-   juce::AudioBuffer<float> buffer(numChannels, static_cast<int>(reader->lengthInSamples));
-
-
-   //Reading data into the buffer
-   reader->read(&buffer, 0, buffer.getNumSamples(), 0, true, true);
-
-
    //Processing audio with the delay effect
    for (int channel = 0; channel < buffer.getNumChannels(); channel++) {
        float* channeldata = buffer.getWritePointer(channel);
@@ -131,8 +117,8 @@ int main() {
    std::unique_ptr<juce::AudioFormatWriter> writer(
        formatManager.findFormatForFileExtension("wav")->createWriterFor(
            new juce::FileOutputStream(outputfile),
-           reader->sampleRate,
-           reader->numChannels,
+           samplerate,
+           static_cast<unsigned int>(numChannels),
            16,
            {},
            0));
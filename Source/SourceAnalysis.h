@@ -0,0 +1,375 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "Trace.h"
+
+// Descriptors for one analysis window of a source file.
+struct AnalysisFrame {
+    float rms;
+    float peak;
+    float onset;     // half-wave rectified spectral flux against the previous window
+    float zcr;       // zero crossings per sample
+    float centroid;  // Hz
+    float flatness;  // geometric / arithmetic mean of the power spectrum (0..1)
+};
+
+enum class Descriptor { rms = 0, peak, onset, zcr, centroid, flatness, numDescriptors };
+
+inline float getDescriptor(const AnalysisFrame& frame, Descriptor d) {
+    switch (d) {
+        case Descriptor::rms:      return frame.rms;
+        case Descriptor::peak:     return frame.peak;
+        case Descriptor::onset:    return frame.onset;
+        case Descriptor::zcr:      return frame.zcr;
+        case Descriptor::centroid: return frame.centroid;
+        case Descriptor::flatness: return frame.flatness;
+        default:                   return 0.0f;
+    }
+}
+
+struct AnalysisSettings {
+    int fftOrder   = 10;   // 1024-sample windows
+    int hopSize    = 512;
+    int numThreads = 0;    // 0 = one per CPU
+    float onsetSensitivity = 1.5f;  // peaks must exceed the local mean flux by this factor
+};
+
+// Fixed-size header at the start of a .grainidx sidecar. The file is laid out as
+// header | AnalysisFrame[numFrames] | int64 onsets[numOnsets] | uint32 order[numDescriptors][numFrames]
+// so it can be memory-mapped and used in place.
+struct AnalysisIndexHeader {
+    char magic[8];
+    juce::uint32 version;
+    juce::uint32 fftOrder;
+    juce::uint32 hopSize;
+    juce::uint32 numChannels;
+    double sampleRate;
+    juce::int64 sourceLength;
+    juce::int64 sourceFileSize;
+    juce::int64 sourceModTime;
+    juce::uint64 numFrames;
+    juce::uint64 numOnsets;
+};
+
+static_assert(sizeof(AnalysisIndexHeader) == 72, "index header layout must stay fixed");
+static_assert(sizeof(AnalysisFrame) == 24, "frame layout must stay fixed");
+
+// Memory-mapped per-window analysis of a source file, cached next to it as "<name>.grainidx".
+// Lookups by position are O(1), onset and descriptor-range queries are O(log n).
+class SourceAnalysisIndex {
+public:
+    static constexpr juce::uint32 currentVersion = 1;
+
+    static juce::File getIndexFileFor(const juce::File& source) {
+        return source.getSiblingFile(source.getFileName() + ".grainidx");
+    }
+
+    // Maps an existing index, or analyses the source and writes one if it is missing or stale.
+    bool loadOrBuild(const juce::File& source, juce::AudioFormatManager& formatManager,
+                     const AnalysisSettings& settings = {}) {
+        if (load(source, settings))
+            return true;
+
+        if (!build(source, formatManager, settings))
+            return false;
+
+        return load(source, settings);
+    }
+
+    bool load(const juce::File& source, const AnalysisSettings& settings = {}) {
+        close();
+        auto indexFile = getIndexFileFor(source);
+        if (!indexFile.existsAsFile())
+            return false;
+
+        auto mapped = std::make_unique<juce::MemoryMappedFile>(indexFile, juce::MemoryMappedFile::readOnly);
+        if (mapped->getData() == nullptr || mapped->getSize() < sizeof(AnalysisIndexHeader))
+            return false;
+
+        auto* h = static_cast<const AnalysisIndexHeader*>(mapped->getData());
+        if (std::memcmp(h->magic, "GRNIDX\0\0", 8) != 0
+            || h->version != currentVersion
+            || h->fftOrder != static_cast<juce::uint32>(settings.fftOrder)
+            || h->hopSize != static_cast<juce::uint32>(settings.hopSize)
+            || h->sourceFileSize != source.getSize()
+            || h->sourceModTime != source.getLastModificationTime().toMilliseconds())
+            return false;
+
+        auto expectedSize = sizeof(AnalysisIndexHeader)
+                          + h->numFrames * sizeof(AnalysisFrame)
+                          + h->numOnsets * sizeof(juce::int64)
+                          + h->numFrames * sizeof(juce::uint32) * static_cast<size_t>(Descriptor::numDescriptors);
+        if (mapped->getSize() < expectedSize)
+            return false;
+
+        auto* base = static_cast<const char*>(mapped->getData());
+        header = h;
+        frames = reinterpret_cast<const AnalysisFrame*>(base + sizeof(AnalysisIndexHeader));
+        onsets = reinterpret_cast<const juce::int64*>(frames + h->numFrames);
+        orders = reinterpret_cast<const juce::uint32*>(onsets + h->numOnsets);
+        mappedFile = std::move(mapped);
+        return true;
+    }
+
+    void close() {
+        mappedFile.reset();
+        header = nullptr;
+        frames = nullptr;
+        onsets = nullptr;
+        orders = nullptr;
+    }
+
+    bool isLoaded() const { return header != nullptr; }
+
+    int getNumFrames() const { return header != nullptr ? static_cast<int>(header->numFrames) : 0; }
+    int getNumOnsets() const { return header != nullptr ? static_cast<int>(header->numOnsets) : 0; }
+    int getHopSize() const { return static_cast<int>(header->hopSize); }
+    int getWindowSize() const { return 1 << header->fftOrder; }
+    double getSampleRate() const { return header->sampleRate; }
+    juce::int64 getSourceLength() const { return header->sourceLength; }
+
+    const AnalysisFrame& getFrame(int index) const { return frames[index]; }
+    juce::int64 getOnset(int index) const { return onsets[index]; }
+
+    // First sample of the given frame's window.
+    juce::int64 frameToSample(int frameIndex) const { return static_cast<juce::int64>(frameIndex) * header->hopSize; }
+
+    // Frame whose hop contains the given sample.
+    int frameAtSample(juce::int64 sample) const {
+        auto frame = static_cast<int>(sample / header->hopSize);
+        return juce::jlimit(0, getNumFrames() - 1, frame);
+    }
+
+    // Index of the first onset at or after the given sample, or getNumOnsets() if there is none.
+    int findNextOnset(juce::int64 sample) const {
+        return static_cast<int>(std::lower_bound(onsets, onsets + getNumOnsets(), sample) - onsets);
+    }
+
+    // Frame indices, in ascending descriptor order, whose descriptor lies within [minValue, maxValue].
+    // The returned [first, last) range points into the mapped index.
+    std::pair<const juce::uint32*, const juce::uint32*> findFramesInRange(Descriptor d, float minValue, float maxValue) const {
+        auto* order = orders + static_cast<size_t>(d) * header->numFrames;
+        auto* end = order + header->numFrames;
+        auto* first = std::lower_bound(order, end, minValue, [this, d](juce::uint32 i, float v) {
+            return getDescriptor(frames[i], d) < v;
+        });
+        auto* last = std::upper_bound(first, end, maxValue, [this, d](float v, juce::uint32 i) {
+            return v < getDescriptor(frames[i], d);
+        });
+        return { first, last };
+    }
+
+    // Analyses the source across worker threads, each with its own reader and FFT, and writes the sidecar.
+    static bool build(const juce::File& source, juce::AudioFormatManager& formatManager,
+                      const AnalysisSettings& settings = {}) {
+        std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(source));
+        if (!reader)
+            return false;
+
+        const int windowSize = 1 << settings.fftOrder;
+        const int hop = settings.hopSize;
+        const juce::int64 length = reader->lengthInSamples;
+        const int numFrames = static_cast<int>(std::max<juce::int64>(1, (length + hop - 1) / hop));
+
+        int numThreads = settings.numThreads > 0 ? settings.numThreads : juce::SystemStats::getNumCpus();
+        numThreads = juce::jlimit(1, juce::jmax(1, numFrames / 64), numThreads);
+
+        std::vector<AnalysisFrame> analysed(static_cast<size_t>(numFrames));
+        std::vector<std::thread> workers;
+        std::atomic<bool> failed { false };
+        const int framesPerSegment = (numFrames + numThreads - 1) / numThreads;
+
+        for (int t = 0; t < numThreads; t++) {
+            int firstFrame = t * framesPerSegment;
+            int lastFrame = juce::jmin(numFrames, firstFrame + framesPerSegment);
+            if (firstFrame >= lastFrame)
+                break;
+
+            workers.emplace_back([&, firstFrame, lastFrame] {
+                TRACE_THREAD_NAME("analysis worker");
+                TRACE_SCOPE("analyse segment");
+                if (!analyseSegment(source, formatManager, settings, reader->sampleRate,
+                                    firstFrame, lastFrame, analysed.data()))
+                    failed = true;
+            });
+        }
+
+        for (auto& w : workers)
+            w.join();
+
+        if (failed)
+            return false;
+
+        auto onsetPositions = pickOnsets(analysed, settings, windowSize, hop);
+
+        std::vector<juce::uint32> order(static_cast<size_t>(numFrames));
+        AnalysisIndexHeader h {};
+        std::memcpy(h.magic, "GRNIDX\0\0", 8);
+        h.version = currentVersion;
+        h.fftOrder = static_cast<juce::uint32>(settings.fftOrder);
+        h.hopSize = static_cast<juce::uint32>(hop);
+        h.numChannels = reader->numChannels;
+        h.sampleRate = reader->sampleRate;
+        h.sourceLength = length;
+        h.sourceFileSize = source.getSize();
+        h.sourceModTime = source.getLastModificationTime().toMilliseconds();
+        h.numFrames = static_cast<juce::uint64>(numFrames);
+        h.numOnsets = onsetPositions.size();
+
+        juce::TemporaryFile temp(getIndexFileFor(source));
+        {
+            juce::FileOutputStream out(temp.getFile());
+            if (!out.openedOk())
+                return false;
+
+            out.write(&h, sizeof(h));
+            out.write(analysed.data(), analysed.size() * sizeof(AnalysisFrame));
+            out.write(onsetPositions.data(), onsetPositions.size() * sizeof(juce::int64));
+
+            for (int d = 0; d < static_cast<int>(Descriptor::numDescriptors); d++) {
+                auto desc = static_cast<Descriptor>(d);
+                for (int i = 0; i < numFrames; i++)
+                    order[static_cast<size_t>(i)] = static_cast<juce::uint32>(i);
+                std::stable_sort(order.begin(), order.end(), [&](juce::uint32 a, juce::uint32 b) {
+                    return getDescriptor(analysed[a], desc) < getDescriptor(analysed[b], desc);
+                });
+                out.write(order.data(), order.size() * sizeof(juce::uint32));
+            }
+
+            out.flush();
+            if (out.getStatus().failed())
+                return false;
+        }
+
+        return temp.overwriteTargetFileWithTemporary();
+    }
+
+private:
+    static bool analyseSegment(const juce::File& source, juce::AudioFormatManager& formatManager,
+                               const AnalysisSettings& settings, double sampleRate,
+                               int firstFrame, int lastFrame, AnalysisFrame* dest) {
+        std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(source));
+        if (!reader)
+            return false;
+
+        const int windowSize = 1 << settings.fftOrder;
+        const int hop = settings.hopSize;
+        const int numBins = windowSize / 2 + 1;
+        const int numChannels = static_cast<int>(reader->numChannels);
+
+        juce::dsp::FFT fft(settings.fftOrder);
+        juce::dsp::WindowingFunction<float> window(static_cast<size_t>(windowSize),
+                                                   juce::dsp::WindowingFunction<float>::hann, false);
+
+        // The flux of the first frame in the segment needs the spectrum of the frame before it.
+        const int startFrame = juce::jmax(0, firstFrame - 1);
+        const int segmentFrames = lastFrame - startFrame;
+        const int segmentSamples = (segmentFrames - 1) * hop + windowSize;
+
+        juce::AudioBuffer<float> segment(numChannels, segmentSamples);
+        if (!reader->read(&segment, 0, segmentSamples, static_cast<juce::int64>(startFrame) * hop, true, true))
+            return false;
+
+        // Mix down to mono in place of channel 0.
+        float* mono = segment.getWritePointer(0);
+        for (int chan = 1; chan < numChannels; chan++)
+            juce::FloatVectorOperations::add(mono, segment.getReadPointer(chan), segmentSamples);
+        if (numChannels > 1)
+            juce::FloatVectorOperations::multiply(mono, 1.0f / numChannels, segmentSamples);
+
+        std::vector<float> fftData(static_cast<size_t>(windowSize) * 2);
+        std::vector<float> magnitudes(static_cast<size_t>(numBins), 0.0f);
+        std::vector<float> previous(static_cast<size_t>(numBins), 0.0f);
+        const float binToHz = static_cast<float>(sampleRate) / windowSize;
+
+        for (int f = startFrame; f < lastFrame; f++) {
+            const float* x = mono + (f - startFrame) * hop;
+
+            float sumSquares = 0.0f, peak = 0.0f;
+            int crossings = 0;
+            for (int i = 0; i < windowSize; i++) {
+                sumSquares += x[i] * x[i];
+                peak = juce::jmax(peak, std::abs(x[i]));
+                if (i > 0 && ((x[i] >= 0.0f) != (x[i - 1] >= 0.0f)))
+                    crossings++;
+            }
+
+            std::copy(x, x + windowSize, fftData.begin());
+            window.multiplyWithWindowingTable(fftData.data(), static_cast<size_t>(windowSize));
+            fft.performFrequencyOnlyForwardTransform(fftData.data(), true);
+
+            float magSum = 0.0f, weightedSum = 0.0f, flux = 0.0f;
+            double logPowerSum = 0.0, powerSum = 0.0;
+            for (int bin = 0; bin < numBins; bin++) {
+                float mag = fftData[static_cast<size_t>(bin)];
+                magnitudes[static_cast<size_t>(bin)] = mag;
+                magSum += mag;
+                weightedSum += mag * bin * binToHz;
+                flux += juce::jmax(0.0f, mag - previous[static_cast<size_t>(bin)]);
+                double power = static_cast<double>(mag) * mag + 1.0e-12;
+                logPowerSum += std::log(power);
+                powerSum += power;
+            }
+            std::swap(magnitudes, previous);
+
+            if (f < firstFrame)
+                continue;
+
+            AnalysisFrame& frame = dest[f];
+            frame.rms = std::sqrt(sumSquares / windowSize);
+            frame.peak = peak;
+            frame.onset = f > 0 ? flux / numBins : 0.0f;
+            frame.zcr = static_cast<float>(crossings) / (windowSize - 1);
+            frame.centroid = magSum > 0.0f ? weightedSum / magSum : 0.0f;
+            frame.flatness = static_cast<float>(std::exp(logPowerSum / numBins) / (powerSum / numBins));
+        }
+
+        return true;
+    }
+
+    // Local maxima of the flux that stand out from the surrounding mean, as window-centre sample positions.
+    static std::vector<juce::int64> pickOnsets(const std::vector<AnalysisFrame>& analysed,
+                                               const AnalysisSettings& settings, int windowSize, int hop) {
+        std::vector<juce::int64> result;
+        const int n = static_cast<int>(analysed.size());
+        const int radius = 8;
+
+        double runningSum = 0.0;
+        for (int i = 0; i < juce::jmin(n, radius + 1); i++)
+            runningSum += analysed[static_cast<size_t>(i)].onset;
+
+        for (int i = 0; i < n; i++) {
+            int lo = i - radius, hi = i + radius;
+            int count = juce::jmin(n - 1, hi) - juce::jmax(0, lo) + 1;
+            float mean = static_cast<float>(runningSum / count);
+            float current = analysed[static_cast<size_t>(i)].onset;
+
+            bool isPeak = current > 0.0f
+                       && (i == 0 || current > analysed[static_cast<size_t>(i - 1)].onset)
+                       && (i == n - 1 || current >= analysed[static_cast<size_t>(i + 1)].onset)
+                       && current > mean * settings.onsetSensitivity;
+            if (isPeak)
+                result.push_back(static_cast<juce::int64>(i) * hop + windowSize / 2);
+
+            // Slide the window of the running mean.
+            if (lo >= 0)
+                runningSum -= analysed[static_cast<size_t>(lo)].onset;
+            if (hi + 1 < n)
+                runningSum += analysed[static_cast<size_t>(hi + 1)].onset;
+        }
+
+        return result;
+    }
+
+    std::unique_ptr<juce::MemoryMappedFile> mappedFile;
+    const AnalysisIndexHeader* header = nullptr;
+    const AnalysisFrame* frames = nullptr;
+    const juce::int64* onsets = nullptr;
+    const juce::uint32* orders = nullptr;
+};
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <vector>
+
+// How a grain's audio is produced from its source.
+enum class GrainMode {
+    timeDomain,       // copy the source segment as is
+    spectralFreeze,   // hold the spectrum at the grain's start for its whole length
+    spectralStretch   // play through the source slower (or faster) than real time, keeping pitch
+};
+
+// Phase-locked phase vocoder for spectral grains.
+//
+// Each output frame is analysed at an arbitrary source position, with its instantaneous
+// frequencies taken from a second analysis one synthesis hop earlier, so frozen, stretched and
+// jumping positions all keep coherent phase. Phases are propagated for spectral peaks only and
+// every other bin keeps its analysed offset from the peak whose region it lies in (identity
+// phase locking). Pitch shifting moves each peak region as a whole.
+//
+// All frame buffers are allocated in prepare(), and frames are transformed in batches so the
+// FFT work for a block runs back to back.
+class PhaseVocoder {
+public:
+    void prepare(int numChannels, int order = 11, int overlap = 4, int maxBatchFrames = 8) {
+        channels = numChannels;
+        fftOrder = order;
+        fftSize = 1 << order;
+        hop = fftSize / overlap;
+        numBins = fftSize / 2 + 1;
+        batchSize = maxBatchFrames;
+        fft = std::make_unique<juce::dsp::FFT>(fftOrder);
+
+        // Periodic Hann for both analysis and synthesis, with the synthesis side divided by the
+        // summed analysis * synthesis overlap so that unmodified frames reconstruct exactly.
+        analysisWindow.resize(static_cast<size_t>(fftSize) + 1);
+        juce::dsp::WindowingFunction<float>::fillWindowingTables(analysisWindow.data(), analysisWindow.size(),
+                                                                 juce::dsp::WindowingFunction<float>::hann, false);
+        analysisWindow.pop_back();
+
+        std::vector<float> overlapSum(static_cast<size_t>(hop), 0.0f);
+        for (int i = 0; i < fftSize; i++)
+            overlapSum[static_cast<size_t>(i % hop)] += analysisWindow[static_cast<size_t>(i)] * analysisWindow[static_cast<size_t>(i)];
+
+        synthesisWindow.resize(static_cast<size_t>(fftSize));
+        for (int i = 0; i < fftSize; i++)
+            synthesisWindow[static_cast<size_t>(i)] = analysisWindow[static_cast<size_t>(i)] / overlapSum[static_cast<size_t>(i % hop)];
+
+        const size_t frameFloats = static_cast<size_t>(fftSize) * 2;
+        currentFrames.assign(frameFloats * static_cast<size_t>(batchSize * channels), 0.0f);
+        previousFrames.assign(frameFloats * static_cast<size_t>(batchSize * channels), 0.0f);
+
+        magnitudes.assign(static_cast<size_t>(numBins), 0.0f);
+        phases.assign(static_cast<size_t>(numBins), 0.0f);
+        previousPhases.assign(static_cast<size_t>(numBins), 0.0f);
+        scratchPhases.assign(static_cast<size_t>(numBins), 0.0f);
+        peaks.reserve(static_cast<size_t>(numBins));
+        synthesisPhases.assign(static_cast<size_t>(channels), std::vector<float>(static_cast<size_t>(numBins), 0.0f));
+        reset();
+    }
+
+    // Forgets the phase history, so the next frame starts from its analysed phases.
+    void reset() {
+        for (auto& chan : synthesisPhases)
+            std::fill(chan.begin(), chan.end(), 0.0f);
+        firstFrame = true;
+    }
+
+    int getLatency() const { return fftSize / 2; }
+
+    // Overwrites dest with numSamples of vocoded audio. Frame centres start at sourcePosition and
+    // advance by sourceRate source samples per output sample (0 freezes, 0.5 stretches by two).
+    void render(const juce::AudioBuffer<float>& source, double sourcePosition, double sourceRate, float pitch,
+                juce::AudioBuffer<float>& dest, int destStart, int numSamples) {
+        for (int chan = 0; chan < dest.getNumChannels(); chan++)
+            dest.clear(chan, destStart, numSamples);
+
+        reset();
+
+        // Frame j is centred on output sample j * hop; starting early enough covers sample 0 fully.
+        const int firstFrameIndex = -(fftSize / 2) / hop + 1;
+        const int lastFrameIndex = (numSamples + fftSize / 2 - 1) / hop;
+
+        for (int batchStart = firstFrameIndex; batchStart <= lastFrameIndex; batchStart += batchSize) {
+            const int count = juce::jmin(batchSize, lastFrameIndex - batchStart + 1);
+
+            // Analysis: two forward transforms per frame and channel, back to back.
+            for (int b = 0; b < count; b++) {
+                double centre = sourcePosition + static_cast<double>(batchStart + b) * hop * sourceRate;
+                auto start = static_cast<juce::int64>(std::floor(centre)) - fftSize / 2;
+                for (int chan = 0; chan < channels; chan++) {
+                    int sourceChannel = juce::jmin(chan, source.getNumChannels() - 1);
+                    analyse(source, sourceChannel, start, frame(currentFrames, b, chan));
+                    analyse(source, sourceChannel, start - hop, frame(previousFrames, b, chan));
+                }
+            }
+
+            // Phase processing has to run frame by frame, since each frame continues the last.
+            for (int b = 0; b < count; b++) {
+                for (int chan = 0; chan < channels; chan++)
+                    processFrame(chan, frame(currentFrames, b, chan), frame(previousFrames, b, chan), pitch);
+                firstFrame = false;
+            }
+
+            // Synthesis: inverse transforms and overlap-add of the windowed frames.
+            for (int b = 0; b < count; b++) {
+                const int outStart = (batchStart + b) * hop - fftSize / 2;
+                const int first = juce::jmax(0, -outStart);
+                const int last = juce::jmin(fftSize, numSamples - outStart);
+                for (int chan = 0; chan < channels; chan++) {
+                    float* data = frame(currentFrames, b, chan);
+                    fft->performRealOnlyInverseTransform(data);
+                    if (first >= last || chan >= dest.getNumChannels())
+                        continue;
+
+                    juce::FloatVectorOperations::multiply(data + first, synthesisWindow.data() + first, last - first);
+                    juce::FloatVectorOperations::add(dest.getWritePointer(chan, destStart + outStart + first),
+                                                     data + first, last - first);
+                }
+            }
+        }
+    }
+
+private:
+    float* frame(std::vector<float>& frames, int batchIndex, int chan) {
+        return frames.data() + static_cast<size_t>(batchIndex * channels + chan) * static_cast<size_t>(fftSize) * 2;
+    }
+
+    void analyse(const juce::AudioBuffer<float>& source, int chan, juce::int64 start, float* data) const {
+        std::fill(data, data + fftSize * 2, 0.0f);
+        const juce::int64 length = source.getNumSamples();
+        const int first = static_cast<int>(std::clamp<juce::int64>(-start, 0, fftSize));
+        const int last = static_cast<int>(std::clamp<juce::int64>(length - start, 0, fftSize));
+        if (first < last) {
+            std::copy(source.getReadPointer(chan) + start + first, source.getReadPointer(chan) + start + last, data + first);
+            juce::FloatVectorOperations::multiply(data + first, analysisWindow.data() + first, last - first);
+        }
+        fft->performRealOnlyForwardTransform(data, true);
+    }
+
+    static float wrapPhase(float phase) {
+        return phase - juce::MathConstants<float>::twoPi * std::round(phase / juce::MathConstants<float>::twoPi);
+    }
+
+    // Replaces the current frame's spectrum with the phase-propagated (and pitch-shifted) one.
+    void processFrame(int chan, float* current, const float* previous, float pitch) {
+        auto* cur = reinterpret_cast<std::complex<float>*>(current);
+        auto* prev = reinterpret_cast<const std::complex<float>*>(previous);
+        auto& synthesis = synthesisPhases[static_cast<size_t>(chan)];
+
+        for (int k = 0; k < numBins; k++) {
+            magnitudes[static_cast<size_t>(k)] = std::abs(cur[k]);
+            phases[static_cast<size_t>(k)] = std::arg(cur[k]);
+            previousPhases[static_cast<size_t>(k)] = std::arg(prev[k]);
+        }
+
+        // Peaks are bins louder than their two neighbours on either side.
+        peaks.clear();
+        for (int k = 2; k < numBins - 2; k++) {
+            float m = magnitudes[static_cast<size_t>(k)];
+            if (m > magnitudes[static_cast<size_t>(k - 1)] && m >= magnitudes[static_cast<size_t>(k + 1)]
+                && m > magnitudes[static_cast<size_t>(k - 2)] && m >= magnitudes[static_cast<size_t>(k + 2)])
+                peaks.push_back(k);
+        }
+
+        std::fill(cur, cur + numBins, std::complex<float>());
+        if (peaks.empty())
+            return;
+
+        const float binToPhase = juce::MathConstants<float>::twoPi * hop / fftSize;
+        auto& nextSynthesis = scratchPhases;
+        std::copy(synthesis.begin(), synthesis.end(), nextSynthesis.begin());
+
+        for (size_t p = 0; p < peaks.size(); p++) {
+            const int peak = peaks[p];
+
+            // Each peak owns the bins halfway to its neighbouring peaks.
+            const int regionStart = p == 0 ? 0 : (peaks[p - 1] + peak) / 2 + 1;
+            const int regionEnd = p + 1 == peaks.size() ? numBins - 1 : (peak + peaks[p + 1]) / 2;
+
+            const int target = juce::roundToInt(peak * pitch);
+            const int shift = target - peak;
+            if (target <= 0 || target >= numBins)
+                continue;
+
+            // Phase advance over one hop from the measured instantaneous frequency.
+            const float expected = binToPhase * peak;
+            const float deviation = wrapPhase(phases[static_cast<size_t>(peak)] - previousPhases[static_cast<size_t>(peak)] - expected);
+            const float advance = (expected + deviation) * pitch;
+
+            const float peakPhase = firstFrame ? phases[static_cast<size_t>(peak)]
+                                               : wrapPhase(synthesis[static_cast<size_t>(target)] + advance);
+            const float rotation = peakPhase - phases[static_cast<size_t>(peak)];
+
+            for (int k = regionStart; k <= regionEnd; k++) {
+                const int out = k + shift;
+                if (out < 0 || out >= numBins)
+                    continue;
+
+                const float phase = phases[static_cast<size_t>(k)] + rotation;
+                cur[out] += std::polar(magnitudes[static_cast<size_t>(k)], phase);
+                nextSynthesis[static_cast<size_t>(out)] = phase;
+            }
+        }
+
+        synthesis.swap(nextSynthesis);
+    }
+
+    int channels = 0, fftOrder = 0, fftSize = 0, hop = 0, numBins = 0, batchSize = 0;
+    bool firstFrame = true;
+
+    std::unique_ptr<juce::dsp::FFT> fft;
+    std::vector<float> analysisWindow, synthesisWindow;
+    std::vector<float> currentFrames, previousFrames;  // batchSize * channels frames of 2 * fftSize floats
+    std::vector<float> magnitudes, phases, previousPhases, scratchPhases;
+    std::vector<int> peaks;
+    std::vector<std::vector<float>> synthesisPhases;
+};
+
+// Renders one grain of the given mode from a source into dest, which must already be sized.
+inline void renderSpectralGrain(PhaseVocoder& vocoder, const juce::AudioBuffer<float>& source, int startSample,
+                                GrainMode mode, float stretch, float pitch, juce::AudioBuffer<float>& dest) {
+    double rate = mode == GrainMode::spectralFreeze ? 0.0 : 1.0 / juce::jmax(0.01f, stretch);
+    vocoder.render(source, startSample, rate, pitch, dest, 0, dest.getNumSamples());
+}
@@ -0,0 +1,163 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <JuceHeader.h>
+#include "GrainRenderer.h"
+#include "StreamingGrainSource.h"
+#include "PeakPyramid.h"
+#include "StreamingEnvelope.h"
+#include "LoudnessMeter.h"
+
+// A grain scheduled in the output, reading from a position anywhere in the source.
+struct ScheduledGrain {
+    juce::int64 outputStart;
+    juce::int64 sourceStart;
+};
+
+// Granulates a source of any length without loading it: grains scan through the source at a
+// fixed rate with random jitter, and are read through a disk-streaming block cache that is
+// prefetched from the grain schedule a few seconds ahead of rendering.
+int main(int argc, char* argv[]) {
+    std::string inputwav  = "/Users/apple/Desktop/Spring25/granBasics/input.wav";
+    std::string outputwav = "/Users/apple/Desktop/Spring25/granBasics/stream.wav";
+    double durationSec = 60.0;
+    double scanRate = 1.0;  // source seconds advanced per output second
+
+    if (argc > 1) inputwav = argv[1];
+    if (argc > 2) outputwav = argv[2];
+    if (argc > 3) durationSec = std::atof(argv[3]);
+    if (argc > 4) scanRate = std::atof(argv[4]);
+
+    auto cwd = juce::File::getCurrentWorkingDirectory();
+    juce::File inputfile = cwd.getChildFile(inputwav);
+    juce::File outputfile = cwd.getChildFile(outputwav);
+
+    juce::AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+
+    juce::AudioFormatReader* reader = formatManager.createReaderFor(inputfile);
+    if (reader == nullptr) {
+        std::cout << "Failed to open input file." << std::endl;
+        return 1;
+    }
+
+    juce::TimeSliceThread diskThread("Grain source reader");
+    diskThread.startThread();
+    StreamingGrainSource source(reader, diskThread);
+
+    const double samplerate = source.getSampleRate();
+    const int numchannels = source.getNumChannels();
+    const juce::int64 sourceLength = source.getLengthInSamples();
+
+    // Set grain and scheduling parameters
+    const int grainSamples = static_cast<int>(0.1 * samplerate);
+    const int interonsetSamples = static_cast<int>(0.025 * samplerate);
+    const int jitterSamples = static_cast<int>(0.5 * samplerate);
+    const juce::int64 outputLength = static_cast<juce::int64>(durationSec * samplerate);
+    const juce::int64 lookaheadSamples = static_cast<juce::int64>(2.0 * samplerate);
+
+    std::vector<ScheduledGrain> schedule;
+    juce::Random random(1234);
+    for (juce::int64 t = 0; t + grainSamples <= outputLength; t += interonsetSamples) {
+        auto centre = static_cast<juce::int64>(static_cast<double>(t) * scanRate) % std::max<juce::int64>(1, sourceLength - grainSamples);
+        auto pos = centre + random.nextInt(juce::Range<int>(-jitterSamples, jitterSamples + 1));
+        schedule.push_back({ t, std::clamp<juce::int64>(pos, 0, std::max<juce::int64>(0, sourceLength - grainSamples)) });
+    }
+
+    outputfile.deleteFile();
+    std::unique_ptr<juce::FileOutputStream> fileStream(outputfile.createOutputStream());
+    if (!fileStream) {
+        std::cout << "Failed to create output stream." << std::endl;
+        return 1;
+    }
+
+    std::unique_ptr<juce::AudioFormatWriter> writer(
+        formatManager.findFormatForFileExtension("wav")->createWriterFor(
+            fileStream.get(),
+            samplerate,
+            static_cast<unsigned int>(numchannels),
+            16,
+            {},
+            0));
+
+    if (!writer) {
+        std::cout << "Failed to create writer." << std::endl;
+        return 1;
+    }
+    fileStream.release();
+
+    GrainShape shape;
+    auto renderEnvelope = getGrainRenderer<float>(EnvelopeShape::hann);
+
+    // Output is rendered a block at a time; grains that overlap the end of a block carry on
+    // into the next one through the overlap-add buffer.
+    const int blockSize = 8192;
+    juce::AudioBuffer<float> mix(numchannels, blockSize + grainSamples);
+    juce::AudioBuffer<float> grain(numchannels, grainSamples);
+    mix.clear();
+
+    // The whole stream fades in, and its release is timed to reach silence on the last sample.
+    StreamingADSR fade;
+    fade.setSampleRate(samplerate);
+    fade.setParameters({ 0.5f, 0.0f, 1.0f, 2.0f });
+    const juce::int64 releaseStart = std::max<juce::int64>(0, outputLength - static_cast<juce::int64>(2.0 * samplerate));
+    fade.noteOn();
+
+    PeakPyramid peaks(numchannels);
+    LoudnessMeter loudness;
+    loudness.prepare(samplerate, numchannels);
+    size_t nextToRender = 0, nextToPrefetch = 0;
+    int incomplete = 0;
+    auto start = juce::Time::getMillisecondCounterHiRes();
+
+    for (juce::int64 blockStart = 0; blockStart < outputLength; blockStart += blockSize) {
+        // Keep the disk thread a couple of seconds ahead of the render position.
+        while (nextToPrefetch < schedule.size() && schedule[nextToPrefetch].outputStart < blockStart + lookaheadSamples) {
+            source.prefetch(schedule[nextToPrefetch].sourceStart, grainSamples);
+            nextToPrefetch++;
+        }
+
+        while (nextToRender < schedule.size() && schedule[nextToRender].outputStart < blockStart + blockSize) {
+            const auto& g = schedule[nextToRender++];
+
+            // Offline, a late block is worth a short wait; a real-time caller would take the silence.
+            source.waitUntilCached(g.sourceStart, grainSamples, 100);
+            if (!source.read(grain.getArrayOfWritePointers(), numchannels, g.sourceStart, grainSamples))
+                incomplete++;
+
+            renderEnvelope(grain.getArrayOfReadPointers(), grain.getArrayOfWritePointers(),
+                           numchannels, grainSamples, shape, 0.5f);
+            const int offset = static_cast<int>(g.outputStart - blockStart);
+            for (int chan = 0; chan < numchannels; chan++)
+                mix.addFrom(chan, offset, grain, chan, 0, grainSamples);
+        }
+
+        const int n = static_cast<int>(std::min<juce::int64>(blockSize, outputLength - blockStart));
+        if (releaseStart >= blockStart && releaseStart < blockStart + blockSize)
+            fade.noteOff(static_cast<int>(releaseStart - blockStart));
+        fade.applyEnvelopeToBuffer(mix, 0, n);
+        writer->writeFromAudioSampleBuffer(mix, 0, n);
+        peaks.addSamples(mix, 0, n);
+        loudness.process(mix, 0, n);
+
+        // Shift the carried-over tail to the front.
+        for (int chan = 0; chan < numchannels; chan++) {
+            float* data = mix.getWritePointer(chan);
+            std::copy(data + blockSize, data + blockSize + grainSamples, data);
+            std::fill(data + grainSamples, data + blockSize + grainSamples, 0.0f);
+        }
+    }
+    auto elapsed = juce::Time::getMillisecondCounterHiRes() - start;
+
+    writer.reset();
+    peaks.finish();
+    if (!peaks.save(PeakPyramid::getSidecarFileFor(outputfile), samplerate))
+        std::cout << "Failed to write peak sidecar." << std::endl;
+
+    diskThread.stopThread(1000);
+    std::cout << "Streaming granulation complete (" << durationSec * 1000.0 / elapsed << "x real time, "
+              << source.getNumHits() << " block hits, " << source.getNumMisses() << " misses, "
+              << incomplete << " grains with silent gaps)." << std::endl;
+    std::cout << "Loudness: " << loudness.getSummary() << "." << std::endl;
+    return 0;
+}
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+
+// An ADSR that runs block by block for as long as it's needed, with the same parameters, stages
+// and transitions as juce::ADSR (attack from the current level, release rate set by the level at
+// note-off, zero-length stages skipped), so it can stand in for one. Levels agree with juce::ADSR's
+// to float rounding, which can put the end of a stage one sample apart.
+//
+// Unlike env() it needs no total length up front: the gate opens with noteOn() and the release
+// starts with noteOff(). Both take a sample offset into the next block rendered, so a gate change
+// lands on the exact sample rather than at the next block boundary.
+//
+// Blocks are rendered stage by stage into a gain buffer, each stage a straight ramp, and the gain
+// is then multiplied into every channel with FloatVectorOperations.
+class StreamingADSR {
+public:
+    using Parameters = juce::ADSR::Parameters;
+
+    StreamingADSR() { recalculateRates(); }
+
+    void setSampleRate(double newSampleRate) {
+        jassert(newSampleRate > 0.0);
+        sampleRate = newSampleRate;
+        recalculateRates();
+    }
+
+    void setParameters(const Parameters& newParameters) {
+        parameters = newParameters;
+        recalculateRates();
+    }
+
+    const Parameters& getParameters() const { return parameters; }
+
+    bool isActive() const { return state != State::idle || numPending > 0; }
+
+    // Returns to silence and forgets any gate changes not yet reached.
+    void reset() {
+        level = 0.0f;
+        state = State::idle;
+        numPending = 0;
+    }
+
+    // Opens the gate sampleOffset samples into the next block rendered.
+    void noteOn(int sampleOffset = 0) { addGateChange(sampleOffset, true); }
+
+    // Closes the gate (starts the release) sampleOffset samples into the next block rendered.
+    void noteOff(int sampleOffset = 0) { addGateChange(sampleOffset, false); }
+
+    float getLevel() const { return level; }
+
+    float getNextSample() {
+        float gain = 0.0f;
+        renderGain(&gain, 1);
+        return gain;
+    }
+
+    // Writes the next numSamples envelope values into gain and advances past them.
+    void renderGain(float* gain, int numSamples) {
+        int pos = 0;
+        while (pos < numSamples) {
+            while (numPending > 0 && pending[0].offset <= pos)
+                applyGateChange();
+
+            const int end = numPending > 0 ? std::min(numSamples, pending[0].offset) : numSamples;
+            while (pos < end)
+                pos = renderStage(gain, pos, end);
+        }
+
+        for (int i = 0; i < numPending; i++)
+            pending[i].offset -= numSamples;
+    }
+
+    // Multiplies the next numSamples envelope values into every channel of buffer.
+    template <typename FloatType>
+    void applyEnvelopeToBuffer(juce::AudioBuffer<FloatType>& buffer, int startSample, int numSamples) {
+        jassert(startSample + numSamples <= buffer.getNumSamples());
+
+        // Nothing changes within the block, so no gain block is needed.
+        if (numPending == 0 && (state == State::idle || state == State::sustain)) {
+            if (state == State::idle)
+                buffer.clear(startSample, numSamples);
+            else
+                buffer.applyGain(startSample, numSamples, static_cast<FloatType>(parameters.sustain));
+            return;
+        }
+
+        float gain[gainBlockSize];
+        for (int done = 0; done < numSamples; done += gainBlockSize) {
+            const int n = std::min(gainBlockSize, numSamples - done);
+            renderGain(gain, n);
+            for (int chan = 0; chan < buffer.getNumChannels(); chan++) {
+                FloatType* data = buffer.getWritePointer(chan, startSample + done);
+                if constexpr (std::is_same_v<FloatType, float>)
+                    juce::FloatVectorOperations::multiply(data, gain, n);
+                else
+                    for (int i = 0; i < n; i++)
+                        data[i] *= static_cast<FloatType>(gain[i]);
+            }
+        }
+    }
+
+private:
+    enum class State { idle, attack, decay, sustain, release };
+
+    struct GateChange {
+        int offset;
+        bool on;
+    };
+
+    static constexpr int maxPending = 32;
+    static constexpr int gainBlockSize = 256;
+
+    void addGateChange(int offset, bool on) {
+        offset = std::max(0, offset);
+
+        // Keep them in order; a full queue drops the oldest change, which the newer ones outlast.
+        if (numPending == maxPending) {
+            std::move(pending + 1, pending + numPending, pending);
+            numPending--;
+        }
+        int i = numPending++;
+        for (; i > 0 && pending[i - 1].offset > offset; i--)
+            pending[i] = pending[i - 1];
+        pending[i] = { offset, on };
+    }
+
+    void applyGateChange() {
+        const bool on = pending[0].on;
+        std::move(pending + 1, pending + numPending, pending);
+        numPending--;
+
+        if (on) {
+            if (attackRate > 0.0f) {
+                state = State::attack;
+            }
+            else if (decayRate > 0.0f) {
+                level = 1.0f;
+                state = State::decay;
+            }
+            else {
+                level = parameters.sustain;
+                state = State::sustain;
+            }
+        }
+        else if (state != State::idle) {
+            if (parameters.release > 0.0f) {
+                releaseRate = static_cast<float>(level / (parameters.release * sampleRate));
+                state = State::release;
+            }
+            else {
+                level = 0.0f;
+                state = State::idle;
+            }
+        }
+    }
+
+    // Renders [from, to) or up to the end of the current stage, whichever is sooner, and returns
+    // where it stopped.
+    int renderStage(float* gain, int from, int to) {
+        switch (state) {
+            case State::idle:
+                juce::FloatVectorOperations::clear(gain + from, to - from);
+                return to;
+
+            case State::sustain:
+                level = parameters.sustain;
+                juce::FloatVectorOperations::fill(gain + from, level, to - from);
+                return to;
+
+            case State::attack:
+                return ramp(gain, from, to, attackRate, 1.0f);
+
+            case State::decay:
+                return ramp(gain, from, to, -decayRate, parameters.sustain);
+
+            case State::release:
+                return ramp(gain, from, to, -releaseRate, 0.0f);
+        }
+        return to;
+    }
+
+    // Steps level by rate each sample towards target. The sample that reaches it is clamped to it,
+    // and the envelope moves on to the next stage.
+    int ramp(float* gain, int from, int to, float rate, float target) {
+        // A rate of zero (released from silence) ends the stage at once.
+        const double steps = rate != 0.0f ? std::ceil(std::abs(target - level) / std::abs(rate)) : 1.0;
+        const int stageLength = static_cast<int>(juce::jlimit(1.0, 1.0e9, steps));
+        const int n = std::min(to - from, stageLength);
+
+        const float start = level;
+        for (int i = 0; i < n; i++)
+            gain[from + i] = start + static_cast<float>(i + 1) * rate;
+
+        if (n == stageLength) {
+            gain[from + n - 1] = target;
+            level = target;
+            goToNextState();
+        }
+        else {
+            level = gain[from + n - 1];
+        }
+        return from + n;
+    }
+
+    void goToNextState() {
+        if (state == State::attack)
+            state = decayRate > 0.0f ? State::decay : State::sustain;
+        else if (state == State::decay)
+            state = State::sustain;
+        else if (state == State::release) {
+            level = 0.0f;
+            state = State::idle;
+        }
+    }
+
+    void recalculateRates() {
+        auto getRate = [this](float distance, float timeInSeconds) {
+            return timeInSeconds > 0.0f ? static_cast<float>(distance / (timeInSeconds * sampleRate)) : -1.0f;
+        };
+
+        attackRate = getRate(1.0f, parameters.attack);
+        decayRate = getRate(1.0f - parameters.sustain, parameters.decay);
+        releaseRate = getRate(parameters.sustain, parameters.release);
+
+        if ((state == State::attack && attackRate <= 0.0f)
+            || (state == State::decay && (decayRate <= 0.0f || level <= parameters.sustain))
+            || (state == State::release && releaseRate <= 0.0f))
+            goToNextState();
+    }
+
+    Parameters parameters;
+    double sampleRate = 44100.0;
+    State state = State::idle;
+    float level = 0.0f;
+    float attackRate = 0.0f, decayRate = 0.0f, releaseRate = 0.0f;
+
+    GateChange pending[maxPending];
+    int numPending = 0;
+};
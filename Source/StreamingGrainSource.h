@@ -0,0 +1,220 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// Grain source for files too large to load, read from disk in fixed-size blocks.
+//
+// A TimeSliceThread decodes blocks into a fixed cache, driven by a queue the render thread fills
+// from its grain schedule (prefetch) and from its own misses. read() never waits: any block that
+// isn't cached yet is returned as silence and counted as a miss. Evicting a block a reader is
+// copying from is prevented by a per-block pin count, so reads take no locks.
+//
+// prefetch() and read() must be called from the same thread (the queue has one producer).
+class StreamingGrainSource : private juce::TimeSliceClient {
+public:
+    // Takes ownership of the reader, which from then on is only used on the time slice thread.
+    StreamingGrainSource(juce::AudioFormatReader* sourceReader, juce::TimeSliceThread& timeSliceThread,
+                         int samplesPerBlock = 65536, int numCacheBlocks = 256, int maxQueuedBlocks = 4096)
+        : reader(sourceReader), thread(timeSliceThread), blockSize(samplesPerBlock),
+          numBlocks(numCacheBlocks), queue(maxQueuedBlocks), queued(static_cast<size_t>(maxQueuedBlocks)) {
+        blocks = std::make_unique<Block[]>(static_cast<size_t>(numBlocks));
+        for (int i = 0; i < numBlocks; i++)
+            blocks[static_cast<size_t>(i)].buffer.setSize(static_cast<int>(reader->numChannels), blockSize);
+
+        thread.addTimeSliceClient(this);
+    }
+
+    ~StreamingGrainSource() override {
+        thread.removeTimeSliceClient(this);
+    }
+
+    int getNumChannels() const { return static_cast<int>(reader->numChannels); }
+    juce::int64 getLengthInSamples() const { return reader->lengthInSamples; }
+    double getSampleRate() const { return reader->sampleRate; }
+
+    juce::int64 getNumHits() const { return hits.load(); }
+    juce::int64 getNumMisses() const { return misses.load(); }
+
+    // Queues the blocks covering a scheduled grain for loading. Blocks already cached are only
+    // marked as recently used. If the queue is full the rest are dropped and retried on a miss.
+    void prefetch(juce::int64 start, int numSamples) {
+        forEachBlock(start, numSamples, [this](juce::int64 index) {
+            int slot = findSlot(index);
+            if (slot >= 0)
+                blocks[static_cast<size_t>(slot)].lastUsed.store(++clock);
+            else
+                enqueue(index);
+        });
+    }
+
+    // True if every block covering the range is cached.
+    bool isCached(juce::int64 start, int numSamples) const {
+        bool cached = true;
+        forEachBlock(start, numSamples, [&](juce::int64 index) { cached = cached && findSlot(index) >= 0; });
+        return cached;
+    }
+
+    // Copies numSamples from the source, starting at start, into dest. Anything not cached (or
+    // outside the file) is written as silence. Returns false if any block missed.
+    bool read(float* const* dest, int numChannels, juce::int64 start, int numSamples) {
+        bool complete = true;
+        int done = 0;
+
+        while (done < numSamples) {
+            const juce::int64 pos = start + done;
+            const juce::int64 index = pos >= 0 ? pos / blockSize : -1 - (-pos - 1) / blockSize;
+            const int offset = static_cast<int>(pos - index * blockSize);
+            const int n = juce::jmin(numSamples - done, blockSize - offset);
+
+            if (index < 0 || index * blockSize >= reader->lengthInSamples) {
+                clear(dest, numChannels, done, n);
+            }
+            else if (!copyFromBlock(index, offset, dest, numChannels, done, n)) {
+                clear(dest, numChannels, done, n);
+                misses++;
+                enqueue(index);
+                complete = false;
+            }
+            else {
+                hits++;
+            }
+            done += n;
+        }
+
+        return complete;
+    }
+
+    // For offline renders only: queues the range and sleeps until it is cached or the timeout
+    // passes. Real-time callers should prefetch early enough instead.
+    bool waitUntilCached(juce::int64 start, int numSamples, int timeoutMs) {
+        prefetch(start, numSamples);
+        auto deadline = juce::Time::getMillisecondCounter() + static_cast<juce::uint32>(timeoutMs);
+        while (!isCached(start, numSamples)) {
+            if (juce::Time::getMillisecondCounter() >= deadline)
+                return false;
+            juce::Thread::sleep(1);
+        }
+        return true;
+    }
+
+private:
+    struct Block {
+        juce::AudioBuffer<float> buffer;
+        std::atomic<juce::int64> index { -1 };    // source block held, or -1 while empty or being refilled
+        std::atomic<int> pins { 0 };               // readers currently copying from the block
+        std::atomic<juce::uint64> lastUsed { 0 };
+    };
+
+    template <typename Function>
+    void forEachBlock(juce::int64 start, int numSamples, Function&& f) const {
+        auto first = std::max<juce::int64>(0, start) / blockSize;
+        auto last = std::min<juce::int64>(start + numSamples, reader->lengthInSamples) - 1;
+        for (auto index = first; index * blockSize <= last; index++)
+            f(index);
+    }
+
+    int findSlot(juce::int64 index) const {
+        for (int i = 0; i < numBlocks; i++)
+            if (blocks[static_cast<size_t>(i)].index.load() == index)
+                return i;
+        return -1;
+    }
+
+    static void clear(float* const* dest, int numChannels, int destStart, int n) {
+        for (int chan = 0; chan < numChannels; chan++)
+            juce::FloatVectorOperations::clear(dest[chan] + destStart, n);
+    }
+
+    // Pins the block, then re-checks that it still holds index: the loader clears index before
+    // checking pins, so either it sees our pin and leaves the block alone, or we see it cleared.
+    bool copyFromBlock(juce::int64 index, int offset, float* const* dest, int numChannels, int destStart, int n) {
+        int slot = findSlot(index);
+        if (slot < 0)
+            return false;
+
+        auto& block = blocks[static_cast<size_t>(slot)];
+        block.pins++;
+        bool valid = block.index.load() == index;
+        if (valid) {
+            const int numValid = static_cast<int>(std::min<juce::int64>(n, reader->lengthInSamples - index * blockSize - offset));
+            for (int chan = 0; chan < numChannels; chan++) {
+                const int sourceChannel = juce::jmin(chan, block.buffer.getNumChannels() - 1);
+                juce::FloatVectorOperations::copy(dest[chan] + destStart, block.buffer.getReadPointer(sourceChannel, offset), numValid);
+                juce::FloatVectorOperations::clear(dest[chan] + destStart + numValid, n - numValid);
+            }
+            block.lastUsed.store(++clock);
+        }
+        block.pins--;
+        return valid;
+    }
+
+    void enqueue(juce::int64 index) {
+        const auto scope = queue.write(1);
+        if (scope.blockSize1 > 0)
+            queued[static_cast<size_t>(scope.startIndex1)] = index;
+    }
+
+    int useTimeSlice() override {
+        for (int loaded = 0; loaded < 8; loaded++) {
+            juce::int64 index = -1;
+            {
+                const auto scope = queue.read(1);
+                if (scope.blockSize1 == 0)
+                    return 5;
+                index = queued[static_cast<size_t>(scope.startIndex1)];
+            }
+            load(index);
+        }
+        return 0;
+    }
+
+    void load(juce::int64 index) {
+        if (findSlot(index) >= 0)
+            return;
+
+        // Empty blocks go first, then the least recently used one that nobody is reading.
+        for (int attempt = 0; attempt < numBlocks; attempt++) {
+            int victim = -1;
+            for (int i = 0; i < numBlocks; i++) {
+                auto& b = blocks[static_cast<size_t>(i)];
+                if (b.pins.load() != 0)
+                    continue;
+                if (victim < 0 || b.lastUsed.load() < blocks[static_cast<size_t>(victim)].lastUsed.load())
+                    victim = i;
+                if (b.index.load() < 0)
+                    break;
+            }
+            if (victim < 0)
+                return;
+
+            auto& block = blocks[static_cast<size_t>(victim)];
+            auto previous = block.index.exchange(-1);
+            if (block.pins.load() != 0) {
+                block.index.store(previous);  // a reader got in first; try another block
+                continue;
+            }
+
+            const auto start = index * blockSize;
+            const int n = static_cast<int>(std::min<juce::int64>(blockSize, reader->lengthInSamples - start));
+            reader->read(&block.buffer, 0, n, start, true, true);
+            block.lastUsed.store(++clock);
+            block.index.store(index);
+            return;
+        }
+    }
+
+    std::unique_ptr<juce::AudioFormatReader> reader;
+    juce::TimeSliceThread& thread;
+    const int blockSize, numBlocks;
+
+    std::unique_ptr<Block[]> blocks;
+    std::atomic<juce::uint64> clock { 0 };
+    std::atomic<juce::int64> hits { 0 }, misses { 0 };
+
+    juce::AbstractFifo queue;
+    std::vector<juce::int64> queued;
+};
@@ -0,0 +1,82 @@
+#include <iostream>
+#include <vector>
+#include <JuceHeader.h>
+#include "TimeStretch.h"
+
+// Pitch-preserving time stretch of a whole file, streamed through the WSOLA stretcher block by block.
+int main(int argc, char* argv[]) {
+    std::string inputwav  = "/Users/apple/Desktop/Spring25/granBasics/input.wav";
+    std::string outputwav = "/Users/apple/Desktop/Spring25/granBasics/stretch.wav";
+    double stretch = 1.5;
+
+    if (argc > 1) inputwav = argv[1];
+    if (argc > 2) outputwav = argv[2];
+    if (argc > 3) stretch = std::atof(argv[3]);
+
+    auto cwd = juce::File::getCurrentWorkingDirectory();
+    juce::File inputfile = cwd.getChildFile(inputwav);
+    juce::File outputfile = cwd.getChildFile(outputwav);
+
+    juce::AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+
+    std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(inputfile));
+    if (!reader) {
+        std::cout << "Failed to open input file." << std::endl;
+        return 1;
+    }
+
+    int numchannels = static_cast<int>(reader->numChannels);
+    outputfile.deleteFile();
+    std::unique_ptr<juce::FileOutputStream> fileStream(outputfile.createOutputStream());
+    if (!fileStream) {
+        std::cout << "Failed to create output stream." << std::endl;
+        return 1;
+    }
+
+    std::unique_ptr<juce::AudioFormatWriter> writer(
+        formatManager.findFormatForFileExtension("wav")->createWriterFor(
+            fileStream.get(),
+            reader->sampleRate,
+            static_cast<unsigned int>(numchannels),
+            16,
+            {},
+            0));
+
+    if (!writer) {
+        std::cout << "Failed to create writer." << std::endl;
+        return 1;
+    }
+    fileStream.release();
+
+    WsolaStretcher stretcher;
+    stretcher.prepare(numchannels, reader->sampleRate);
+    stretcher.setStretch(stretch);
+
+    const int blockSize = 4096;
+    juce::AudioBuffer<float> inBlock(numchannels, blockSize);
+    juce::AudioBuffer<float> outBlock(numchannels, blockSize);
+
+    // Hands everything the stretcher has finished to the writer.
+    auto drain = [&] {
+        while (stretcher.getNumReady() > 0) {
+            int n = stretcher.read(outBlock.getArrayOfWritePointers(), blockSize);
+            writer->writeFromAudioSampleBuffer(outBlock, 0, n);
+        }
+    };
+
+    auto start = juce::Time::getMillisecondCounterHiRes();
+    for (juce::int64 pos = 0; pos < reader->lengthInSamples; pos += blockSize) {
+        int n = static_cast<int>(std::min<juce::int64>(blockSize, reader->lengthInSamples - pos));
+        reader->read(&inBlock, 0, n, pos, true, true);
+        stretcher.write(inBlock.getArrayOfReadPointers(), n);
+        drain();
+    }
+    stretcher.finish();
+    drain();
+    auto elapsed = juce::Time::getMillisecondCounterHiRes() - start;
+
+    double seconds = static_cast<double>(reader->lengthInSamples) / reader->sampleRate;
+    std::cout << "Time stretch complete (" << seconds * 1000.0 / elapsed << "x real time)." << std::endl;
+    return 0;
+}
@@ -0,0 +1,287 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <limits>
+#include <vector>
+
+// Streaming WSOLA (waveform-similarity overlap-add) time stretcher.
+//
+// Hann-windowed grains are overlap-added at a fixed synthesis hop of half a grain. Each grain is
+// read from around its nominal input position, shifted within +-tolerance to the offset whose
+// normalised cross-correlation with the natural continuation of the previous grain is highest.
+// The correlation over the whole search window is computed with one FFT round trip on a
+// decimated mono signal, and the winning lag is then refined at full rate.
+//
+// Push input with write(), pull output with read(), and call finish() once the input has ended.
+class WsolaStretcher {
+public:
+    void prepare(int numChannels, double sampleRate, double grainMs = 40.0, double toleranceMs = 10.0) {
+        channels = numChannels;
+        grainSize = juce::nextPowerOfTwo(juce::roundToInt(sampleRate * grainMs / 1000.0));
+        synthesisHop = grainSize / 2;
+        tolerance = juce::jmax(1, juce::roundToInt(sampleRate * toleranceMs / 1000.0));
+
+        // The coarse search runs at roughly 12 kHz, which keeps enough of the waveform to align on.
+        decimation = juce::jlimit(1, 16, juce::roundToInt(sampleRate / 12000.0));
+        const int coarseGrain = grainSize / decimation;
+        const int coarseSearch = (grainSize + 2 * tolerance) / decimation;
+
+        // Linear correlation of a grain with the search window without wrap-around.
+        fftOrder = juce::roundToInt(std::log2(juce::nextPowerOfTwo(coarseGrain + coarseSearch)));
+        fft = std::make_unique<juce::dsp::FFT>(fftOrder);
+        const int fftSize = 1 << fftOrder;
+
+        // Periodic Hann (the first grainSize points of a grainSize + 1 table) sums to exactly 1 at 50% overlap.
+        window.resize(static_cast<size_t>(grainSize) + 1);
+        juce::dsp::WindowingFunction<float>::fillWindowingTables(window.data(), window.size(),
+                                                                 juce::dsp::WindowingFunction<float>::hann, false);
+        window.pop_back();
+
+        templateSpectrum.assign(static_cast<size_t>(fftSize) * 2, 0.0f);
+        searchSpectrum.assign(static_cast<size_t>(fftSize) * 2, 0.0f);
+        templateSignal.assign(static_cast<size_t>(grainSize), 0.0f);
+        searchSignal.assign(static_cast<size_t>(grainSize + 2 * tolerance), 0.0f);
+        energyPrefix.assign(searchSignal.size() + 1, 0.0);
+        coarseEnergyPrefix.assign(static_cast<size_t>(coarseSearch) + 1, 0.0);
+
+        input.assign(static_cast<size_t>(channels), {});
+        output.assign(static_cast<size_t>(channels), std::vector<float>(static_cast<size_t>(grainSize), 0.0f));
+        reset();
+    }
+
+    void reset() {
+        for (auto& chan : input)
+            chan.clear();
+        for (auto& chan : output)
+            std::fill(chan.begin(), chan.end(), 0.0f);
+
+        inputStart = 0;
+        inputEnd = 0;
+        nominalPosition = 0.0;
+        previousPosition = -1;
+        numReady = 0;
+        finished = false;
+    }
+
+    // Output duration / input duration. Can be changed between calls to write().
+    void setStretch(double ratio) { stretch = juce::jlimit(0.01, 100.0, ratio); }
+    double getStretch() const { return stretch; }
+
+    int getGrainSize() const { return grainSize; }
+
+    void write(const float* const* data, int numSamples) {
+        for (int chan = 0; chan < channels; chan++)
+            input[static_cast<size_t>(chan)].insert(input[static_cast<size_t>(chan)].end(), data[chan], data[chan] + numSamples);
+        inputEnd += numSamples;
+        processAvailableGrains();
+    }
+
+    // Marks the end of the input, so the remaining grains are rendered against silence.
+    void finish() {
+        if (finished)
+            return;
+
+        finished = true;
+        processAvailableGrains();
+
+        // Whatever is left in the overlap-add tail is now complete.
+        if (previousPosition >= 0)
+            numReady += synthesisHop;
+    }
+
+    int getNumReady() const { return numReady; }
+
+    // Copies up to numSamples finished samples out and returns how many were copied.
+    int read(float* const* data, int numSamples) {
+        int count = juce::jmin(numSamples, numReady);
+        for (int chan = 0; chan < channels; chan++) {
+            auto& out = output[static_cast<size_t>(chan)];
+            std::copy(out.begin(), out.begin() + count, data[chan]);
+            out.erase(out.begin(), out.begin() + count);
+        }
+        numReady -= count;
+        return count;
+    }
+
+private:
+    // Renders every grain whose search window is fully available.
+    void processAvailableGrains() {
+        while (true) {
+            auto nominal = static_cast<juce::int64>(nominalPosition);
+            if (finished) {
+                if (nominal >= inputEnd)
+                    break;
+            }
+            else if (nominal + tolerance + grainSize > inputEnd) {
+                break;
+            }
+
+            juce::int64 position = previousPosition < 0 ? nominal : findBestPosition(nominal);
+            addGrain(position);
+            previousPosition = position;
+            nominalPosition += synthesisHop / stretch;
+            discardConsumedInput();
+        }
+    }
+
+    // Sums the channels over [position, position + length), reading silence outside the buffered input.
+    void copyMono(juce::int64 position, int length, float* dest) const {
+        std::fill(dest, dest + length, 0.0f);
+        int first = static_cast<int>(std::clamp<juce::int64>(inputStart - position, 0, length));
+        int last = static_cast<int>(std::clamp<juce::int64>(inputEnd - position, 0, length));
+        if (first >= last)
+            return;
+
+        for (auto& chan : input)
+            juce::FloatVectorOperations::add(dest + first, chan.data() + (position - inputStart + first), last - first);
+    }
+
+    // Normalised correlation of the full-rate template against the search signal at one lag.
+    double scoreAt(int lag) const {
+        double energy = energyPrefix[static_cast<size_t>(lag + grainSize)] - energyPrefix[static_cast<size_t>(lag)];
+        double dot = 0.0;
+        const float* x = searchSignal.data() + lag;
+        for (int i = 0; i < grainSize; i++)
+            dot += templateSignal[static_cast<size_t>(i)] * x[i];
+        return dot / std::sqrt(energy + 1.0e-9);
+    }
+
+    juce::int64 findBestPosition(juce::int64 nominal) {
+        const int fftSize = 1 << fftOrder;
+        const int searchLength = static_cast<int>(searchSignal.size());
+        const int coarseGrain = grainSize / decimation;
+        const int coarseSearch = searchLength / decimation;
+        const juce::int64 searchStart = nominal - tolerance;
+
+        // The natural continuation of the previous grain. It is left unwindowed so that, normalised by
+        // the candidate's energy, an exact continuation always scores highest.
+        copyMono(previousPosition + synthesisHop, grainSize, templateSignal.data());
+
+        copyMono(searchStart, searchLength, searchSignal.data());
+        for (int i = 0; i < searchLength; i++)
+            energyPrefix[static_cast<size_t>(i) + 1] = energyPrefix[static_cast<size_t>(i)]
+                                                     + static_cast<double>(searchSignal[static_cast<size_t>(i)]) * searchSignal[static_cast<size_t>(i)];
+
+        // Box-filtered decimation of both signals for the coarse FFT search.
+        std::fill(templateSpectrum.begin(), templateSpectrum.end(), 0.0f);
+        std::fill(searchSpectrum.begin(), searchSpectrum.end(), 0.0f);
+        for (int i = 0; i < coarseGrain; i++)
+            for (int j = 0; j < decimation; j++)
+                templateSpectrum[static_cast<size_t>(i)] += templateSignal[static_cast<size_t>(i * decimation + j)];
+        for (int i = 0; i < coarseSearch; i++) {
+            float sum = 0.0f;
+            for (int j = 0; j < decimation; j++)
+                sum += searchSignal[static_cast<size_t>(i * decimation + j)];
+            searchSpectrum[static_cast<size_t>(i)] = sum;
+            coarseEnergyPrefix[static_cast<size_t>(i) + 1] = coarseEnergyPrefix[static_cast<size_t>(i)] + static_cast<double>(sum) * sum;
+        }
+
+        fft->performRealOnlyForwardTransform(templateSpectrum.data(), true);
+        fft->performRealOnlyForwardTransform(searchSpectrum.data(), true);
+
+        // correlation[lag] = sum_i template[i] * search[lag + i]  <=>  conj(T) * S
+        auto* t = reinterpret_cast<std::complex<float>*>(templateSpectrum.data());
+        auto* s = reinterpret_cast<std::complex<float>*>(searchSpectrum.data());
+        for (int bin = 0; bin <= fftSize / 2; bin++)
+            s[bin] *= std::conj(t[bin]);
+
+        fft->performRealOnlyInverseTransform(searchSpectrum.data());
+
+        // Candidates before the start of the stream are not valid. Ties (silence, for one) go to the
+        // natural continuation, so a stretch of 1 reproduces the input exactly.
+        const int minLag = static_cast<int>(std::clamp<juce::int64>(-searchStart, 0, 2 * tolerance));
+        const int maxCoarseLag = juce::jmin(2 * tolerance / decimation, coarseSearch - coarseGrain);
+        const int naturalLag = static_cast<int>(std::clamp<juce::int64>(previousPosition + synthesisHop - searchStart,
+                                                                        minLag, 2 * tolerance));
+
+        auto coarseScore = [&](int lag) {
+            double energy = coarseEnergyPrefix[static_cast<size_t>(lag + coarseGrain)] - coarseEnergyPrefix[static_cast<size_t>(lag)];
+            return searchSpectrum[static_cast<size_t>(lag)] / std::sqrt(energy + 1.0e-9);
+        };
+
+        int bestCoarse = juce::jlimit(0, maxCoarseLag, naturalLag / decimation);
+        double bestScore = coarseScore(bestCoarse);
+        for (int lag = (minLag + decimation - 1) / decimation; lag <= maxCoarseLag; lag++) {
+            double score = coarseScore(lag);
+            if (score > bestScore) {
+                bestScore = score;
+                bestCoarse = lag;
+            }
+        }
+
+        // Refine around the coarse winner at full rate.
+        const int refineStart = juce::jmax(minLag, bestCoarse * decimation - decimation + 1);
+        const int refineEnd = juce::jmin(2 * tolerance, bestCoarse * decimation + decimation - 1);
+        int bestLag = juce::jlimit(refineStart, refineEnd, naturalLag);
+        bestScore = scoreAt(bestLag);
+        for (int lag = refineStart; lag <= refineEnd; lag++) {
+            double score = scoreAt(lag);
+            if (score > bestScore) {
+                bestScore = score;
+                bestLag = lag;
+            }
+        }
+
+        return searchStart + bestLag;
+    }
+
+    void addGrain(juce::int64 position) {
+        // Extend the overlap-add area so it covers this grain.
+        const size_t needed = static_cast<size_t>(numReady + grainSize);
+        for (auto& out : output)
+            if (out.size() < needed)
+                out.resize(needed, 0.0f);
+
+        for (int chan = 0; chan < channels; chan++) {
+            const auto& in = input[static_cast<size_t>(chan)];
+            float* out = output[static_cast<size_t>(chan)].data() + numReady;
+
+            // Only the part of the grain that lies inside the buffered input contributes.
+            int first = static_cast<int>(std::clamp<juce::int64>(inputStart - position, 0, grainSize));
+            int last = static_cast<int>(std::clamp<juce::int64>(inputEnd - position, 0, grainSize));
+            for (int i = first; i < last; i++)
+                out[i] += in[static_cast<size_t>(position - inputStart + i)] * window[static_cast<size_t>(i)];
+        }
+
+        numReady += synthesisHop;
+    }
+
+    void discardConsumedInput() {
+        // The next grain reads from nominal - tolerance at the earliest, and its template
+        // from previousPosition + synthesisHop.
+        auto keepFrom = std::min(static_cast<juce::int64>(nominalPosition) - tolerance,
+                                 previousPosition + synthesisHop);
+        auto discard = static_cast<int>(std::clamp<juce::int64>(keepFrom - inputStart, 0, inputEnd - inputStart));
+
+        // Erasing from the front is amortised by only doing it once a few grains have piled up.
+        if (discard < 4 * grainSize)
+            return;
+
+        for (auto& chan : input)
+            chan.erase(chan.begin(), chan.begin() + discard);
+        inputStart += discard;
+    }
+
+    int channels = 0;
+    int grainSize = 0;
+    int synthesisHop = 0;
+    int tolerance = 0;
+    int decimation = 1;
+    int fftOrder = 0;
+    double stretch = 1.0;
+
+    std::unique_ptr<juce::dsp::FFT> fft;
+    std::vector<float> window, templateSignal, searchSignal, templateSpectrum, searchSpectrum;
+    std::vector<double> energyPrefix, coarseEnergyPrefix;
+
+    std::vector<std::vector<float>> input;   // buffered input from sample inputStart onwards
+    std::vector<std::vector<float>> output;  // [0, numReady) finished, the rest still accumulating
+    juce::int64 inputStart = 0, inputEnd = 0;
+    double nominalPosition = 0.0;
+    juce::int64 previousPosition = -1;
+    int numReady = 0;
+    bool finished = false;
+};
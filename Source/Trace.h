@@ -0,0 +1,185 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Timeline tracing for the offline tools, written as Chrome trace event JSON (open it in
+// Perfetto or chrome://tracing).
+//
+// Each thread records into its own fixed-size buffer, which only that thread writes, so a scope
+// costs two clock reads and a store. Buffers belong to the process-wide registry and outlive
+// their threads; the JSON is written once, when the Trace::Session in main() ends.
+//
+// Build with GRANULAR_TRACE=0 to compile every marker out. When compiled in but no session is
+// running, a marker is one atomic load and a branch.
+#ifndef GRANULAR_TRACE
+ #define GRANULAR_TRACE 1
+#endif
+
+namespace Trace {
+    struct Event {
+        const char* name;     // must be a string literal (or otherwise outlive the session)
+        juce::int64 start;    // nanoseconds since the session started
+        juce::int64 duration;
+    };
+
+    struct ThreadBuffer {
+        std::vector<Event> events;
+        std::atomic<size_t> count { 0 };
+        std::atomic<size_t> dropped { 0 };
+        int threadId = 0;
+        juce::String threadName;
+    };
+
+    struct Registry {
+        std::atomic<bool> enabled { false };
+        std::chrono::steady_clock::time_point origin;
+        std::mutex mutex;
+        std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+        size_t eventsPerThread = 1 << 16;
+    };
+
+    inline Registry& getRegistry() {
+        static Registry registry;
+        return registry;
+    }
+
+    inline bool isEnabled() {
+        return getRegistry().enabled.load(std::memory_order_acquire);
+    }
+
+    inline juce::int64 now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - getRegistry().origin).count();
+    }
+
+    // The calling thread's buffer, registered on first use (the only time the lock is taken).
+    inline ThreadBuffer& getThreadBuffer() {
+        thread_local ThreadBuffer* buffer = nullptr;
+        if (buffer == nullptr) {
+            auto& r = getRegistry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.buffers.push_back(std::make_unique<ThreadBuffer>());
+            buffer = r.buffers.back().get();
+            buffer->events.resize(r.eventsPerThread);
+            buffer->threadId = static_cast<int>(r.buffers.size());
+        }
+        return *buffer;
+    }
+
+    inline void record(const char* name, juce::int64 start, juce::int64 end) {
+        auto& b = getThreadBuffer();
+        const auto index = b.count.load(std::memory_order_relaxed);
+        if (index >= b.events.size()) {
+            b.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        b.events[index] = { name, start, end - start };
+        b.count.store(index + 1, std::memory_order_release);
+    }
+
+    // Labels the calling thread's track in the timeline.
+    inline void setThreadName(const juce::String& name) {
+        if (isEnabled())
+            getThreadBuffer().threadName = name;
+    }
+
+    // Times the enclosing scope.
+    class Scope {
+    public:
+        explicit Scope(const char* scopeName) : name(isEnabled() ? scopeName : nullptr) {
+            if (name != nullptr)
+                start = now();
+        }
+
+        ~Scope() {
+            if (name != nullptr)
+                record(name, start, now());
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        const char* name;
+        juce::int64 start = 0;
+    };
+
+    // Collects events between construction and destruction and writes them to a JSON file.
+    // Threads still recording when it ends should be joined first.
+    class Session {
+    public:
+        explicit Session(const juce::File& file, bool enable = true) : output(file), active(enable && GRANULAR_TRACE) {
+            if (!active)
+                return;
+            auto& r = getRegistry();
+            r.origin = std::chrono::steady_clock::now();
+            r.enabled.store(true);
+            setThreadName("main");
+        }
+
+        ~Session() {
+            if (!active)
+                return;
+            auto& r = getRegistry();
+            r.enabled.store(false);
+            write();
+        }
+
+    private:
+        void write() const {
+            auto& r = getRegistry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+
+            output.deleteFile();
+            juce::FileOutputStream out(output);
+            if (!out.openedOk())
+                return;
+
+            out << "{\"traceEvents\":[\n";
+            bool first = true;
+            auto separator = [&] { out << (first ? "" : ",\n"); first = false; };
+
+            size_t dropped = 0;
+            for (auto& b : r.buffers) {
+                if (b->threadName.isNotEmpty()) {
+                    separator();
+                    out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << b->threadId
+                        << ",\"args\":{\"name\":" << juce::JSON::toString(b->threadName) << "}}";
+                }
+
+                const auto count = b->count.load(std::memory_order_acquire);
+                for (size_t i = 0; i < count; i++) {
+                    const auto& e = b->events[i];
+                    separator();
+                    out << "{\"ph\":\"X\",\"name\":" << juce::JSON::toString(juce::String(e.name))
+                        << ",\"pid\":1,\"tid\":" << b->threadId
+                        << ",\"ts\":" << juce::String(e.start / 1000.0, 3)
+                        << ",\"dur\":" << juce::String(e.duration / 1000.0, 3) << "}";
+                }
+                dropped += b->dropped.load();
+            }
+            out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+            if (dropped > 0)
+                std::cout << "Trace buffers were full; " << dropped << " events dropped." << std::endl;
+        }
+
+        juce::File output;
+        bool active;
+    };
+}
+
+#if GRANULAR_TRACE
+ #define GRANULAR_TRACE_CONCAT_(a, b) a##b
+ #define GRANULAR_TRACE_CONCAT(a, b) GRANULAR_TRACE_CONCAT_(a, b)
+ #define TRACE_SCOPE(name) Trace::Scope GRANULAR_TRACE_CONCAT(traceScope_, __LINE__)(name)
+ #define TRACE_THREAD_NAME(name) Trace::setThreadName(name)
+#else
+ #define TRACE_SCOPE(name)
+ #define TRACE_THREAD_NAME(name)
+#endif
@@ -0,0 +1,162 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <JuceHeader.h>
+#include "PeakPyramid.h"
+#include "GrainMap.h"
+
+// Draws one channel's waveform into its lane, one min/max column per pixel with the RMS as a
+// brighter band inside it. Works from an in-memory PeakPyramid or a mapped PeakPyramidFile.
+template <typename Pyramid>
+static void drawWaveform(juce::Graphics& g, const Pyramid& peaks, int chan, juce::Rectangle<int> lane,
+                         juce::int64 numSamples) {
+    const float mid = lane.getCentreY();
+    const float halfHeight = lane.getHeight() * 0.5f;
+
+    for (int x = 0; x < lane.getWidth(); x++) {
+        auto start = numSamples * x / lane.getWidth();
+        auto end = numSamples * (x + 1) / lane.getWidth();
+        auto range = peaks.getRange(chan, start, juce::jmax(start + 1, end));
+        float top = mid - juce::jlimit(-1.0f, 1.0f, range.max) * halfHeight;
+        float bottom = mid - juce::jlimit(-1.0f, 1.0f, range.min) * halfHeight;
+        float rms = juce::jmin(1.0f, range.rms) * halfHeight;
+        const float left = static_cast<float>(lane.getX() + x);
+
+        g.setColour(juce::Colour(0xff4f8fc0));
+        g.fillRect(juce::Rectangle<float>(left, top, 1.0f, juce::jmax(1.0f, bottom - top)));
+        g.setColour(juce::Colour(0xff9fdcff));
+        g.fillRect(juce::Rectangle<float>(left, mid - rms, 1.0f, juce::jmax(1.0f, 2.0f * rms)));
+    }
+}
+
+// Marks each grain's onset and traces its envelope across the lane, rendered at pixel
+// resolution with the same renderer the grains used.
+static void drawGrains(juce::Graphics& g, const std::vector<GrainMapEntry>& grains, juce::Rectangle<int> lane,
+                       juce::int64 numSamples) {
+    const double scale = static_cast<double>(lane.getWidth()) / static_cast<double>(std::max<juce::int64>(1, numSamples));
+    std::vector<float> ones, envelope;
+
+    for (const auto& grain : grains) {
+        const float x0 = lane.getX() + static_cast<float>(grain.outputStart * scale);
+        g.setColour(juce::Colour(0x60ffb347));
+        g.drawVerticalLine(juce::roundToInt(x0), static_cast<float>(lane.getY()), static_cast<float>(lane.getBottom()));
+
+        const int width = juce::roundToInt(grain.numSamples * scale);
+        if (width < 3)
+            continue;
+
+        GrainShape shape = grain.shape;
+        shape.attack = juce::roundToInt(shape.attack * scale);
+        shape.decay = juce::roundToInt(shape.decay * scale);
+        shape.release = juce::roundToInt(shape.release * scale);
+
+        ones.assign(static_cast<size_t>(width), 1.0f);
+        envelope.resize(static_cast<size_t>(width));
+        const float* src = ones.data();
+        float* dest = envelope.data();
+        getGrainRenderer<float>(static_cast<EnvelopeShape>(grain.envelope))(&src, &dest, 1, width, shape, 1.0f);
+
+        juce::Path path;
+        for (int i = 0; i < width; i++) {
+            float y = lane.getBottom() - envelope[static_cast<size_t>(i)] * lane.getHeight();
+            if (i == 0)
+                path.startNewSubPath(x0, y);
+            else
+                path.lineTo(x0 + static_cast<float>(i), y);
+        }
+        g.setColour(juce::Colour(0xc0ffb347));
+        g.strokePath(path, juce::PathStrokeType(1.0f));
+    }
+}
+
+// Renders a PNG of a file's waveform from a min/max/RMS peak pyramid, with the grains from its
+// .grainmap sidecar (written by the renderer) drawn over it when one exists. The pyramid is
+// mapped from the file's .peaks sidecar when it is current; otherwise the audio is scanned once
+// and the sidecar written for next time.
+int main(int argc, char* argv[]) {
+    std::string inputwav = "/Users/apple/Desktop/Spring25/granBasics/grain1.wav";
+    std::string outputpng = "/Users/apple/Desktop/Spring25/granBasics/grain1.png";
+    int width = 1600;
+    int laneHeight = 200;
+
+    if (argc > 1) inputwav = argv[1];
+    if (argc > 2) outputpng = argv[2];
+    if (argc > 3) width = std::atoi(argv[3]);
+    if (argc > 4) laneHeight = std::atoi(argv[4]);
+
+    auto cwd = juce::File::getCurrentWorkingDirectory();
+    juce::File inputfile = cwd.getChildFile(inputwav);
+    juce::File outputfile = cwd.getChildFile(outputpng);
+
+    juce::AudioFormatManager formatManager;
+    formatManager.registerBasicFormats();
+
+    std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(inputfile));
+    if (!reader) {
+        std::cout << "Failed to open input file." << std::endl;
+        return 1;
+    }
+
+    const int numchannels = static_cast<int>(reader->numChannels);
+    const juce::int64 numSamples = reader->lengthInSamples;
+    auto sidecar = PeakPyramid::getSidecarFileFor(inputfile);
+
+    auto start = juce::Time::getMillisecondCounterHiRes();
+    PeakPyramidFile mapped;
+    bool current = sidecar.getLastModificationTime() >= inputfile.getLastModificationTime()
+                   && mapped.open(sidecar)
+                   && mapped.getNumSamples() == numSamples
+                   && mapped.getNumChannels() == numchannels;
+
+    PeakPyramid scanned(numchannels);
+    if (!current) {
+        // Stream the file through the pyramid a block at a time, so long files never sit in memory.
+        juce::AudioBuffer<float> block(numchannels, 1 << 16);
+        for (juce::int64 pos = 0; pos < numSamples; pos += block.getNumSamples()) {
+            int n = static_cast<int>(std::min<juce::int64>(block.getNumSamples(), numSamples - pos));
+            reader->read(&block, 0, n, pos, true, true);
+            scanned.addSamples(block.getArrayOfReadPointers(), n);
+        }
+        scanned.finish();
+        if (!scanned.save(sidecar, reader->sampleRate))
+            std::cout << "Failed to write peak sidecar." << std::endl;
+    }
+    auto built = juce::Time::getMillisecondCounterHiRes();
+
+    double grainRate = 0.0;
+    std::vector<GrainMapEntry> grains;
+    bool haveGrains = readGrainMap(getGrainMapFileFor(inputfile), grainRate, grains);
+
+    juce::Image image(juce::Image::ARGB, width, laneHeight * numchannels, true);
+    {
+        juce::Graphics g(image);
+        g.fillAll(juce::Colour(0xff1e1e24));
+        for (int chan = 0; chan < numchannels; chan++) {
+            juce::Rectangle<int> lane(0, chan * laneHeight, width, laneHeight);
+            g.setColour(juce::Colour(0xff3a3a44));
+            g.drawHorizontalLine(lane.getCentreY(), 0.0f, static_cast<float>(width));
+            if (current)
+                drawWaveform(g, mapped, chan, lane, numSamples);
+            else
+                drawWaveform(g, scanned, chan, lane, numSamples);
+            if (haveGrains)
+                drawGrains(g, grains, lane, numSamples);
+        }
+    }
+
+    outputfile.deleteFile();
+    juce::FileOutputStream out(outputfile);
+    juce::PNGImageFormat png;
+    if (!out.openedOk() || !png.writeImageToStream(image, out)) {
+        std::cout << "Failed to write image." << std::endl;
+        return 1;
+    }
+    auto drawn = juce::Time::getMillisecondCounterHiRes();
+
+    std::cout << "Waveform written (" << (current ? "mapped peaks " : "scanned audio ") << built - start
+              << " ms, drawing " << drawn - built << " ms";
+    if (haveGrains)
+        std::cout << ", " << grains.size() << " grains";
+    std::cout << ")." << std::endl;
+    return 0;
+}